@@ -1,6 +1,11 @@
 INCLUDEPATH += $$PWD
 
 HEADERS += $$PWD/fft.h \
-           $$PWD/inlines.h
+           $$PWD/fft_kernels.h \
+           $$PWD/fft_kernel_simd.h \
+           $$PWD/inlines.h \
+           $$PWD/spectrum.h
 
-SOURCES += $$PWD/fft.c
+SOURCES += $$PWD/fft.c \
+           $$PWD/fft_kernels.c \
+           $$PWD/spectrum.c
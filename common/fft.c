@@ -19,9 +19,6 @@
 
 /*
  * TODO
- * Remove compiling in of FFT_BUFFER_SIZE?  (Might slow things down, but would
- * be nice to be able to change size at runtime.)
- * Finish making / checking thread-safety.
  * More optimisations.
  */
 
@@ -35,9 +32,11 @@
 #endif
 
 #include "fft.h"
+#include "fft_kernels.h"
 
 #include <math.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 
 #ifndef PI
 #ifdef M_PI
@@ -51,72 +50,254 @@
 /* # Structs # */
 /* ########### */
 
+/*
+ * Tables for one transform size.  A plan is never changed after it has been
+ * built, apart from its kernel, so any number of states may share it.
+ *
+ * Real input of size samples is transformed as a complex sequence of half
+ * the length: even samples in the real part, odd samples in the imaginary
+ * part.  Stereo input uses the full length, with the left channel in the
+ * real part and the right channel in the imaginary part.
+ */
+struct _struct_fft_plan {
+    unsigned int log;
+    unsigned int size;
+    /* Butterfly kernel, see fft_kernels.c */
+    atomic_int kernel;
+
+    /* Table to speed up bit reverse copy.
+     * For i < size / 2, bitReverse[i] is twice the reversal of i over
+     * log - 1 bits, which is the even sample index the half size
+     * transform needs. */
+    unsigned int *bitReverse;
+
+    /* Butterfly factors, stored per step so that the exchanges of one step
+     * read them contiguously: the step with e exchanges per group uses
+     * entries e .. 2e - 1, holding cos(j * PI / e) and sin(j * PI / e).
+     * The last step doubles as the table of cos(2 * PI * k / size) that the
+     * split of the half size transform needs. */
+    float *twiddle_real;
+    float *twiddle_imag;
+};
+
 struct _struct_fft_state {
+    const fft_plan *plan;
+    /* Analysis window applied while preparing, or NULL */
+    const float *window;
     /* Temporary data stores to perform FFT in. */
-    float real[FFT_BUFFER_SIZE];
-    float imag[FFT_BUFFER_SIZE];
+    float *real;
+    float *imag;
+    /* Lane interleaved store for fft_perform_batch, allocated on first use */
+    float *batch;
+    unsigned int batch_lanes;
 };
 
 /* ############################# */
 /* # Local function prototypes # */
 /* ############################# */
 
-static void fft_prepare(const float *input, float *re, float *im);
-static void fft_calculate(float *re, float *im);
-static void fft_output(const float *re, const float *im, float *output);
-static int reverseBits(unsigned int initial);
+static void fft_prepare(const float *input, float *re, float *im, const fft_state *state);
+static void fft_prepare_stereo(const float *left, const float *right, float *re, float *im, const fft_state *state);
+static void fft_prepare_pair(const float *const *inputs, const float *const *windows, float *re, float *im, const fft_plan *plan);
+static void fft_calculate(float *re, float *im, unsigned int log, const fft_plan *plan);
+static void fft_output(const float *re, const float *im, float *output, const fft_plan *plan);
+static void fft_output_stereo(const float *re, const float *im, float *left, float *right, const fft_plan *plan);
+static void fft_output_complex(const float *re, const float *im, float *output_real, float *output_imag, const fft_plan *plan);
+static void fft_output_stereo_complex(const float *re, const float *im, float *const *outputs, const fft_plan *plan);
+static int reverseBits(unsigned int initial, unsigned int log);
+static int sizeLog(unsigned int size);
 
 /* #################### */
 /* # Global variables # */
 /* #################### */
 
-/* Table to speed up bit reverse copy */
-static unsigned int bitReverse[FFT_BUFFER_SIZE];
+/* Plans handed out by fft_plan_get, one per size, built on first use.
+ * They live as long as the process. */
+static _Atomic(fft_plan *) plan_cache[FFT_SIZE_LOG_MAX - FFT_SIZE_LOG_MIN + 1];
 
-/* The next two tables could be made to use less space in memory, since they
- * overlap hugely, but hey. */
-static float sintable[FFT_BUFFER_SIZE / 2];
-static float costable[FFT_BUFFER_SIZE / 2];
+/* Kernel given to new plans, FFT_KERNEL_COUNT until first needed */
+static atomic_int default_kernel = FFT_KERNEL_COUNT;
 
 /* ############################## */
 /* # Externally called routines # */
 /* ############################## */
 
+/* ---------- */
+/* Plan stuff */
+/* ---------- */
+
+/*
+ * Builds the tables for a transform of size points, size being a power of
+ * two between FFT_SIZE_MIN and FFT_SIZE_MAX.
+ * On error, returns NULL.
+ * The pointer should be freed when it is finished with, by fft_plan_destroy().
+ */
+fft_plan *fft_plan_create(unsigned int size)
+{
+    fft_plan *plan;
+    unsigned int i, exchanges;
+    const int log = sizeLog(size);
+
+    if(log < 0)
+        return 0;
+
+    /* One block for the plan and its tables */
+    plan = (fft_plan *) malloc(sizeof(fft_plan) + size * (sizeof(unsigned int) + 2 * sizeof(float)));
+    if(!plan)
+        return 0;
+
+    plan->log = log;
+    plan->size = size;
+    atomic_init(&plan->kernel, fft_get_kernel());
+    plan->twiddle_real = (float *) (plan + 1);
+    plan->twiddle_imag = plan->twiddle_real + size;
+    plan->bitReverse = (unsigned int *) (plan->twiddle_imag + size);
+
+    for(i = 0; i < size; ++i) {
+        plan->bitReverse[i] = reverseBits(i, log);
+    }
+
+    plan->twiddle_real[0] = 1;
+    plan->twiddle_imag[0] = 0;
+    for(exchanges = 1; exchanges < size; exchanges <<= 1) {
+        for(i = 0; i < exchanges; ++i) {
+            float j = PI * i / exchanges;
+            plan->twiddle_real[exchanges + i] = cos(j);
+            plan->twiddle_imag[exchanges + i] = sin(j);
+        }
+    }
+
+    return plan;
+}
+
+/*
+ * Free a plan from fft_plan_create.  Plans from fft_plan_get must not be
+ * freed.
+ */
+void fft_plan_destroy(fft_plan *plan)
+{
+    if(plan)
+        free(plan);
+}
+
+/*
+ * Returns the shared plan for size points, building it on first use.
+ * Safe to call from any thread.
+ * On error, returns NULL.
+ */
+fft_plan *fft_plan_get(unsigned int size)
+{
+    fft_plan *plan, *expected = 0;
+    const int log = sizeLog(size);
+
+    if(log < 0)
+        return 0;
+
+    plan = atomic_load_explicit(&plan_cache[log - FFT_SIZE_LOG_MIN], memory_order_acquire);
+    if(plan)
+        return plan;
+
+    plan = fft_plan_create(size);
+    if(!plan)
+        return 0;
+
+    /* Another thread may have been quicker, use its plan then */
+    if(!atomic_compare_exchange_strong_explicit(&plan_cache[log - FFT_SIZE_LOG_MIN], &expected, plan,
+                                                memory_order_acq_rel, memory_order_acquire)) {
+        fft_plan_destroy(plan);
+        plan = expected;
+    }
+    return plan;
+}
+
+unsigned int fft_plan_size(const fft_plan *plan)
+{
+    return plan->size;
+}
+
+fft_kernel fft_plan_get_kernel(const fft_plan *plan)
+{
+    return (fft_kernel) atomic_load(&plan->kernel);
+}
+
+/*
+ * Sets the butterfly kernel of one plan, kernels the CPU can not run are
+ * replaced by the scalar one.  States using the plan pick it up on their
+ * next transform.
+ */
+void fft_plan_set_kernel(fft_plan *plan, fft_kernel kernel)
+{
+    if(!fft_kernel_supported(kernel))
+        kernel = FFT_KERNEL_SCALAR;
+    atomic_store(&plan->kernel, kernel);
+}
+
 /* --------- */
 /* FFT stuff */
 /* --------- */
 
 /*
- * Initialisation routine - sets up tables and space to work in.
+ * Initialisation routine - sets up space to work in for a plan.
  * Returns a pointer to internal state, to be used when performing calls.
  * On error, returns NULL.
  * The pointer should be freed when it is finished with, by fft_close().
+ * The plan must outlive the state.
  */
-fft_state *fft_init(void)
+fft_state *fft_init_plan(const fft_plan *plan)
 {
     fft_state *state;
-    unsigned int i;
 
-    state = (fft_state *) malloc(sizeof(fft_state));
-    if(!state)
+    if(!plan)
         return 0;
 
-    for(i = 0; i < FFT_BUFFER_SIZE; ++i) {
-        bitReverse[i] = reverseBits(i);
-    }
-    for(i = 0; i < FFT_BUFFER_SIZE / 2; ++i) {
-        float j = 2 * PI * i / FFT_BUFFER_SIZE;
-        costable[i] = cos(j);
-        sintable[i] = sin(j);
-    }
+    state = (fft_state *) malloc(sizeof(fft_state) + 2 * plan->size * sizeof(float));
+    if(!state)
+        return 0;
 
+    state->plan = plan;
+    state->window = 0;
+    state->real = (float *) (state + 1);
+    state->imag = state->real + plan->size;
+    state->batch = 0;
+    state->batch_lanes = 0;
     return state;
 }
 
+/*
+ * Same as fft_init_plan, with the shared plan for size points.
+ */
+fft_state *fft_init_size(unsigned int size)
+{
+    return fft_init_plan(fft_plan_get(size));
+}
+
+/*
+ * Same as fft_init_size, for FFT_BUFFER_SIZE points.
+ */
+fft_state *fft_init(void)
+{
+    return fft_init_size(FFT_BUFFER_SIZE);
+}
+
+unsigned int fft_state_size(const fft_state *state)
+{
+    return state->plan->size;
+}
+
+/*
+ * Sets the window every input frame is multiplied with, as many values as
+ * the plan's size, or NULL for none.  The window is not copied, it must
+ * stay valid until it is replaced or the state is closed.
+ */
+void fft_set_window(fft_state *state, const float *window)
+{
+    state->window = window;
+}
+
 /*
  * Do all the steps of the FFT, taking as input sound data (as described in
  * sound.h) and returning the intensities of each frequency as floats in the
- * range 0 to ((FFT_BUFFER_SIZE / 2) * 32768) ^ 2
+ * range 0 to ((size / 2) * 32768) ^ 2
  *
  * FIXME - the above range assumes no frequencies present have an amplitude
  * larger than that of the sample variation.  But this is false: we could have
@@ -125,20 +306,151 @@ fft_state *fft_init(void)
  * Question: what _is_ the maximum value possible.  Twice that value?  Root
  * two times that value?  Hmmm.  Think it depends on the frequency, too.
  *
- * The input array is assumed to have FFT_BUFFER_SIZE elements,
- * and the output array is assumed to have (FFT_BUFFER_SIZE / 2 + 1) elements.
+ * The input array is assumed to have as many elements as the size of the
+ * state's plan, and the output array is assumed to have (size / 2 + 1)
+ * elements.
  * state is a (non-NULL) pointer returned by fft_init.
  */
 void fft_perform(const float *input, float *output, fft_state * state)
 {
+    const fft_plan *plan = state->plan;
+
     /* Convert data from sound format to be ready for FFT */
-    fft_prepare(input, state->real, state->imag);
+    fft_prepare(input, state->real, state->imag, state);
 
     /* Do the actual FFT */
-    fft_calculate(state->real, state->imag);
+    fft_calculate(state->real, state->imag, plan->log - 1, plan);
 
     /* Convert the FFT output into intensities */
-    fft_output(state->real, state->imag, output);
+    fft_output(state->real, state->imag, output, plan);
+}
+
+/*
+ * Same as fft_perform, but returns the complex spectrum X[0] to X[size / 2]
+ * instead of the intensities, for analyses that need the phase:
+ *   X[k] = sum of input[n] * 32767 * exp(2 pi i k n / size)
+ * Unlike fft_perform the constant and highest frequency terms are not
+ * divided.
+ *
+ * Both output arrays are assumed to have (size / 2 + 1) elements.
+ */
+void fft_perform_complex(const float *input, float *output_real, float *output_imag, fft_state * state)
+{
+    const fft_plan *plan = state->plan;
+
+    fft_prepare(input, state->real, state->imag, state);
+    fft_calculate(state->real, state->imag, plan->log - 1, plan);
+    fft_output_complex(state->real, state->imag, output_real, output_imag, plan);
+}
+
+/*
+ * Same as fft_perform, for two channels at once.  Both channels share one
+ * complex transform of the full size, which costs about as much as a single
+ * fft_perform call on each channel would.
+ *
+ * The input arrays are assumed to have size elements each, and the output
+ * arrays are assumed to have (size / 2 + 1) elements each.
+ */
+void fft_perform_stereo(const float *left, const float *right, float *output_left, float *output_right, fft_state * state)
+{
+    const fft_plan *plan = state->plan;
+
+    fft_prepare_stereo(left, right, state->real, state->imag, state);
+    fft_calculate(state->real, state->imag, plan->log, plan);
+    fft_output_stereo(state->real, state->imag, output_left, output_right, plan);
+}
+
+/*
+ * Same as fft_perform_complex, for two channels through one transform.
+ * outputs holds the left real, left imaginary, right real and right
+ * imaginary arrays, (size / 2 + 1) elements each.
+ */
+void fft_perform_stereo_complex(const float *left, const float *right, float *const *outputs, fft_state * state)
+{
+    const fft_plan *plan = state->plan;
+
+    fft_prepare_stereo(left, right, state->real, state->imag, state);
+    fft_calculate(state->real, state->imag, plan->log, plan);
+    fft_output_stereo_complex(state->real, state->imag, outputs, plan);
+}
+
+/*
+ * Same as calling fft_perform_complex on count frames, each with its own
+ * window, for instance to get the derivatives of a spectrum.  Frames are
+ * paired through one complex transform of the full size as in
+ * fft_perform_stereo_complex, an odd one left over goes through the half
+ * size transform.  The state's window is not used.
+ *
+ * inputs and windows hold count pointers each, a window may be NULL.
+ * outputs holds the real and imaginary arrays of every frame in turn,
+ * 2 * count pointers to (size / 2 + 1) elements each.
+ */
+void fft_perform_complex_batch(const float *const *inputs, const float *const *windows, float *const *outputs, unsigned int count, fft_state * state)
+{
+    const fft_plan *plan = state->plan;
+    const float *window = state->window;
+    unsigned int i;
+
+    for(i = 0; i + 2 <= count; i += 2) {
+        fft_prepare_pair(inputs + i, windows + i, state->real, state->imag, plan);
+        fft_calculate(state->real, state->imag, plan->log, plan);
+        fft_output_stereo_complex(state->real, state->imag, outputs + 2 * i, plan);
+    }
+
+    if(i < count) {
+        state->window = windows[i];
+        fft_perform_complex(inputs[i], outputs[2 * i], outputs[2 * i + 1], state);
+        state->window = window;
+    }
+}
+
+/*
+ * Same as calling fft_perform on count frames, but several frames are
+ * transformed at once, one per vector lane.  Frames left over after the
+ * last full group of lanes go through fft_perform.  How much faster that
+ * is depends on the kernel and size, from 1.4x for sse2 at large sizes up
+ * to 5x for avx512 at 256 points, see batch_faster in fft_kernels.c.
+ *
+ * inputs and outputs hold count pointers each, sized as for fft_perform.
+ */
+void fft_perform_batch(const float *const *inputs, float *const *outputs, unsigned int count, fft_state * state)
+{
+    const fft_plan *plan = state->plan;
+    const fft_kernel kernel = (fft_kernel) atomic_load_explicit(&plan->kernel, memory_order_relaxed);
+    unsigned int lanes, done = 0;
+    const fft_batch_func batch = fft_batch_get(kernel, &lanes);
+
+    if(batch && count >= lanes) {
+        if(state->batch_lanes < lanes) {
+            float *scratch = (float *) malloc(lanes * plan->size * sizeof(float));
+            if(scratch) {
+                free(state->batch);
+                state->batch = scratch;
+                state->batch_lanes = lanes;
+            }
+        }
+
+        if(state->batch_lanes >= lanes) {
+            for(; done + lanes <= count; done += lanes) {
+                batch(inputs + done, outputs + done, plan->log, plan->bitReverse,
+                      plan->twiddle_real, plan->twiddle_imag, state->window, state->batch);
+            }
+        }
+    }
+
+    for(; done < count; ++done)
+        fft_perform(inputs[done], outputs[done], state);
+}
+
+/*
+ * Returns how many frames fft_perform_batch transforms at once with the
+ * plan's current kernel, 1 when it has no batch that is faster.
+ */
+unsigned int fft_batch_lanes(const fft_state *state)
+{
+    unsigned int lanes;
+    fft_batch_get((fft_kernel) atomic_load_explicit(&state->plan->kernel, memory_order_relaxed), &lanes);
+    return lanes;
 }
 
 /*
@@ -146,8 +458,43 @@ void fft_perform(const float *input, float *output, fft_state * state)
  */
 void fft_close(fft_state * state)
 {
-    if(state)
+    if(state) {
+        free(state->batch);
         free(state);
+    }
+}
+
+/*
+ * Returns the butterfly kernel new plans get.
+ */
+fft_kernel fft_get_kernel(void)
+{
+    int kernel = atomic_load(&default_kernel);
+    if(kernel == FFT_KERNEL_COUNT) {
+        kernel = fft_kernel_select();
+        atomic_store(&default_kernel, kernel);
+    }
+    return (fft_kernel) kernel;
+}
+
+/*
+ * Forces a butterfly kernel on new and shared plans, kernels the CPU can
+ * not run are replaced by the scalar one.
+ */
+void fft_set_kernel(fft_kernel kernel)
+{
+    unsigned int i;
+    fft_plan *plan;
+
+    if(!fft_kernel_supported(kernel))
+        kernel = FFT_KERNEL_SCALAR;
+
+    atomic_store(&default_kernel, kernel);
+    for(i = 0; i < sizeof(plan_cache) / sizeof(plan_cache[0]); ++i) {
+        plan = atomic_load(&plan_cache[i]);
+        if(plan)
+            atomic_store(&plan->kernel, kernel);
+    }
 }
 
 /* ########################### */
@@ -155,92 +502,268 @@ void fft_close(fft_state * state)
 /* ########################### */
 
 /*
- * Prepare data to perform an FFT on
+ * Prepare data to perform an FFT on, applying the window if there is one
+ */
+static void fft_prepare(const float *input, float *re, float *im, const fft_state *state)
+{
+    unsigned int i;
+    float *realptr = re;
+    float *imagptr = im;
+    const unsigned int *bitReverse = state->plan->bitReverse;
+    const unsigned int half = state->plan->size / 2;
+    const float *window = state->window;
+
+    /* Get input, in reverse bit order, packing sample pairs into
+     * one complex value */
+    if(window) {
+        for(i = 0; i < half; ++i) {
+            const unsigned int j = bitReverse[i];
+            *realptr++ = input[j] * window[j] * 32767.0f;
+            *imagptr++ = input[j + 1] * window[j + 1] * 32767.0f;
+        }
+    } else {
+        for(i = 0; i < half; ++i) {
+            const float *pair = input + bitReverse[i];
+            *realptr++ = pair[0] * 32767.0;
+            *imagptr++ = pair[1] * 32767.0;
+        }
+    }
+}
+
+/*
+ * Prepare two channels to perform one FFT on
  */
-static void fft_prepare(const float *input, float *re, float *im)
+static void fft_prepare_stereo(const float *left, const float *right, float *re, float *im, const fft_state *state)
 {
     unsigned int i;
     float *realptr = re;
     float *imagptr = im;
+    const unsigned int *bitReverse = state->plan->bitReverse;
+    const unsigned int size = state->plan->size;
+    const float *window = state->window;
 
     /* Get input, in reverse bit order */
-    for(i = 0; i < FFT_BUFFER_SIZE; ++i) {
-        *realptr++ = input[bitReverse[i]] * 32767.0;
-        *imagptr++ = 0;
+    if(window) {
+        for(i = 0; i < size; ++i) {
+            const unsigned int j = bitReverse[i];
+            const float factor = window[j] * 32767.0f;
+            *realptr++ = left[j] * factor;
+            *imagptr++ = right[j] * factor;
+        }
+    } else {
+        for(i = 0; i < size; ++i) {
+            *realptr++ = left[bitReverse[i]] * 32767.0;
+            *imagptr++ = right[bitReverse[i]] * 32767.0;
+        }
     }
 }
 
+/*
+ * Prepare two frames, each with its own window, to perform one FFT on
+ */
+static void fft_prepare_pair(const float *const *inputs, const float *const *windows, float *re, float *im, const fft_plan *plan)
+{
+    unsigned int i, j;
+    const unsigned int *bitReverse = plan->bitReverse;
+
+    for(i = 0; i < plan->size; ++i) {
+        j = bitReverse[i];
+        re[i] = inputs[0][j] * (windows[0] ? windows[0][j] : 1.0f) * 32767.0f;
+        im[i] = inputs[1][j] * (windows[1] ? windows[1][j] : 1.0f) * 32767.0f;
+    }
+}
+
+/*
+ * Run the plan's butterfly kernel on 2 ^ log points
+ */
+static void fft_calculate(float *re, float *im, unsigned int log, const fft_plan *plan)
+{
+    const fft_kernel kernel = (fft_kernel) atomic_load_explicit(&plan->kernel, memory_order_relaxed);
+    fft_kernel_get(kernel)(re, im, log, plan->twiddle_real, plan->twiddle_imag);
+}
+
 /*
  * Take result of an FFT and calculate the intensities of each frequency
  * Note: only produces half as many data points as the input had.
  * This is roughly a consequence of the Nyquist sampling theorm thingy.
  * (FIXME - make this comment better, and helpful.)
  *
+ * The half size transform holds the spectra of the even (E) and odd (O)
+ * samples at once, Z = E + i * O.  Both are spectra of real data, so they
+ * are conjugate symmetric and can be told apart again:
+ *   E[k] = (Z[k] + conj(Z[N/2 - k])) / 2
+ *   O[k] = (Z[k] - conj(Z[N/2 - k])) / 2i
+ * and the spectrum of the whole input is X[k] = E[k] + W^k * O[k].
+ *
  * The two divisions by 4 are also a consequence of this: the contributions
  * returned for each frequency are split into two parts, one at i in the
- * table, and the other at FFT_BUFFER_SIZE - i, except for i = 0 and
- * FFT_BUFFER_SIZE which would otherwise get float (and then 4* when squared)
+ * table, and the other at size - i, except for i = 0 and
+ * size which would otherwise get float (and then 4* when squared)
  * the contributions.
  */
-static void fft_output(const float *re, const float *im, float *output)
+static void fft_output(const float *re, const float *im, float *output, const fft_plan *plan)
 {
-    float *outputptr = output;
-    const float *realptr = re;
-    const float *imagptr = im;
-    float *endptr = output + FFT_BUFFER_SIZE / 2;
+    unsigned int k;
+    float even_real, even_imag;
+    float odd_real, odd_imag;
+    float out_real, out_imag;
+    const unsigned int half = plan->size / 2;
+    const float *twr = plan->twiddle_real + half;
+    const float *twi = plan->twiddle_imag + half;
 
 #ifdef DEBUG
     unsigned int i, j;
 #endif
 
-    while(outputptr <= endptr) {
-        *outputptr = (*realptr * *realptr) + (*imagptr * *imagptr);
-        outputptr++;
-        realptr++;
-        imagptr++;
+    /* E[0] and O[0] are purely real */
+    out_real = re[0] + im[0];
+    output[0] = out_real * out_real;
+    out_real = re[0] - im[0];
+    output[half] = out_real * out_real;
+
+    for(k = 1; k < half; ++k) {
+        const unsigned int m = half - k;
+        even_real = (re[k] + re[m]) * 0.5f;
+        even_imag = (im[k] - im[m]) * 0.5f;
+        odd_real = (im[k] + im[m]) * 0.5f;
+        odd_imag = (re[m] - re[k]) * 0.5f;
+
+        out_real = even_real + twr[k] * odd_real - twi[k] * odd_imag;
+        out_imag = even_imag + twr[k] * odd_imag + twi[k] * odd_real;
+        output[k] = (out_real * out_real) + (out_imag * out_imag);
     }
     /* Do divisions to keep the constant and highest frequency terms in scale
      * with the other terms. */
-    *output /= 4;
-    *endptr /= 4;
+    output[0] /= 4;
+    output[half] /= 4;
 
 #ifdef DEBUG
     printf("Recalculated input:\n");
-    for(i = 0; i < FFT_BUFFER_SIZE; ++i) {
+    for(i = 0; i < half; ++i) {
         float val_real = 0;
         float val_imag = 0;
-        for(j = 0; j < FFT_BUFFER_SIZE; ++j) {
-            float fact_real = cos(-2 * j * i * PI / FFT_BUFFER_SIZE);
-            float fact_imag = sin(-2 * j * i * PI / FFT_BUFFER_SIZE);
+        for(j = 0; j < half; ++j) {
+            float fact_real = cos(-2 * j * i * PI / half);
+            float fact_imag = sin(-2 * j * i * PI / half);
             val_real += fact_real * re[j] - fact_imag * im[j];
             val_imag += fact_real * im[j] + fact_imag * re[j];
         }
         printf("%5d = %8f + i * %8f\n", i,
-               val_real / FFT_BUFFER_SIZE, val_imag / FFT_BUFFER_SIZE);
+               val_real / half, val_imag / half);
     }
     printf("\n");
 #endif
 }
 
 /*
- * Actually perform the FFT
+ * Same split as fft_output, keeping the complex values.
  */
-static void fft_calculate(float *re, float *im)
+static void fft_output_complex(const float *re, const float *im, float *output_real, float *output_imag, const fft_plan *plan)
+{
+    unsigned int k;
+    float even_real, even_imag;
+    float odd_real, odd_imag;
+    const unsigned int half = plan->size / 2;
+    const float *twr = plan->twiddle_real + half;
+    const float *twi = plan->twiddle_imag + half;
+
+    output_real[0] = re[0] + im[0];
+    output_imag[0] = 0.0f;
+    output_real[half] = re[0] - im[0];
+    output_imag[half] = 0.0f;
+
+    for(k = 1; k < half; ++k) {
+        const unsigned int m = half - k;
+        even_real = (re[k] + re[m]) * 0.5f;
+        even_imag = (im[k] - im[m]) * 0.5f;
+        odd_real = (im[k] + im[m]) * 0.5f;
+        odd_imag = (re[m] - re[k]) * 0.5f;
+
+        output_real[k] = even_real + twr[k] * odd_real - twi[k] * odd_imag;
+        output_imag[k] = even_imag + twr[k] * odd_imag + twi[k] * odd_real;
+    }
+}
+
+/*
+ * Take result of a stereo FFT and calculate the intensities of each
+ * frequency for both channels.
+ *
+ * With Z = L + i * R and both channels real:
+ *   L[k] = (Z[k] + conj(Z[N - k])) / 2
+ *   R[k] = (Z[k] - conj(Z[N - k])) / 2i
+ * Only the squared magnitudes are needed, so the factor i is dropped.
+ */
+static void fft_output_stereo(const float *re, const float *im, float *left, float *right, const fft_plan *plan)
+{
+    unsigned int k;
+    float tmp_real, tmp_imag;
+    const unsigned int half = plan->size / 2;
+
+    /* Z[0] and Z[N / 2] hold each channel in their own part */
+    left[0] = re[0] * re[0] / 4;
+    right[0] = im[0] * im[0] / 4;
+    left[half] = re[half] * re[half] / 4;
+    right[half] = im[half] * im[half] / 4;
+
+    for(k = 1; k < half; ++k) {
+        const unsigned int m = plan->size - k;
+        tmp_real = (re[k] + re[m]) * 0.5f;
+        tmp_imag = (im[k] - im[m]) * 0.5f;
+        left[k] = (tmp_real * tmp_real) + (tmp_imag * tmp_imag);
+
+        tmp_real = (im[k] + im[m]) * 0.5f;
+        tmp_imag = (re[k] - re[m]) * 0.5f;
+        right[k] = (tmp_real * tmp_real) + (tmp_imag * tmp_imag);
+    }
+}
+
+/*
+ * Same split as fft_output_stereo, keeping the complex values:
+ *   R[k] = (Z[k] - conj(Z[N - k])) / 2i
+ */
+static void fft_output_stereo_complex(const float *re, const float *im, float *const *outputs, const fft_plan *plan)
+{
+    unsigned int k;
+    float *left_real = outputs[0], *left_imag = outputs[1];
+    float *right_real = outputs[2], *right_imag = outputs[3];
+    const unsigned int half = plan->size / 2;
+
+    left_real[0] = re[0];
+    left_imag[0] = 0.0f;
+    right_real[0] = im[0];
+    right_imag[0] = 0.0f;
+    left_real[half] = re[half];
+    left_imag[half] = 0.0f;
+    right_real[half] = im[half];
+    right_imag[half] = 0.0f;
+
+    for(k = 1; k < half; ++k) {
+        const unsigned int m = plan->size - k;
+        left_real[k] = (re[k] + re[m]) * 0.5f;
+        left_imag[k] = (im[k] - im[m]) * 0.5f;
+        right_real[k] = (im[k] + im[m]) * 0.5f;
+        right_imag[k] = (re[m] - re[k]) * 0.5f;
+    }
+}
+
+/*
+ * Actually perform the FFT, on 2 ^ log points
+ * This is the portable kernel, the vectorised ones live in fft_kernels.c.
+ */
+void fft_calculate_scalar(float *re, float *im, unsigned int log, const float *twr, const float *twi)
 {
     unsigned int i, j, k;
     unsigned int exchanges;
     float fact_real, fact_imag;
     float tmp_real, tmp_imag;
-    unsigned int factfact;
 
     /* Set up some variables to reduce calculation in the loops */
     exchanges = 1;
-    factfact = FFT_BUFFER_SIZE / 2;
 
     /* Loop through the divide and conquer steps */
-    for(i = FFT_BUFFER_SIZE_LOG; i != 0; --i) {
+    for(i = log; i != 0; --i) {
         /* In this step, we have 2 ^ (i - 1) exchange groups, each with
-         * 2 ^ (FFT_BUFFER_SIZE_LOG - i) exchanges
+         * 2 ^ (log - i) exchanges
          */
         /* Loop through the exchanges in a group */
         for(j = 0; j != exchanges; ++j) {
@@ -249,11 +772,11 @@ static void fft_calculate(float *re, float *im)
              * So, real = cos(j * PI / exchanges),
              *     imag = sin(j * PI / exchanges)
              */
-            fact_real = costable[j * factfact];
-            fact_imag = sintable[j * factfact];
+            fact_real = twr[exchanges + j];
+            fact_imag = twi[exchanges + j];
 
             /* Loop through all the exchange groups */
-            for(k = j; k < FFT_BUFFER_SIZE; k += exchanges << 1) {
+            for(k = j; k < (1u << log); k += exchanges << 1) {
                 int k1 = k + exchanges;
                 /* newval[k]  := val[k] + factor * val[k1]
                  * newval[k1] := val[k] - factor * val[k1]
@@ -263,7 +786,6 @@ static void fft_calculate(float *re, float *im)
                 printf("Exchange %d with %d\n", k, k1);
                 printf("Factor %9f + i * %8f\n", fact_real, fact_imag);
 #endif
-                /* FIXME - potential scope for more optimization here? */
                 tmp_real = fact_real * re[k1] - fact_imag * im[k1];
                 tmp_imag = fact_real * im[k1] + fact_imag * re[k1];
                 re[k1] = re[k] - tmp_real;
@@ -271,24 +793,36 @@ static void fft_calculate(float *re, float *im)
                 re[k] += tmp_real;
                 im[k] += tmp_imag;
 #ifdef DEBUG
-                for(k1 = 0; k1 < FFT_BUFFER_SIZE; ++k1) {
+                for(k1 = 0; k1 < (1 << log); ++k1) {
                     printf("%5d = %8f + i * %8f\n", k1, real[k1], imag[k1]);
                 }
 #endif
             }
         }
         exchanges <<= 1;
-        factfact >>= 1;
     }
 }
 
-static int reverseBits(unsigned int initial)
+static int reverseBits(unsigned int initial, unsigned int log)
 {
     unsigned int reversed = 0, loop;
-    for(loop = 0; loop < FFT_BUFFER_SIZE_LOG; ++loop) {
+    for(loop = 0; loop < log; ++loop) {
         reversed <<= 1;
         reversed += (initial & 1);
         initial >>= 1;
     }
     return reversed;
 }
+
+/*
+ * Returns log2 of size, or -1 if size is not a supported transform size.
+ */
+static int sizeLog(unsigned int size)
+{
+    int log;
+    for(log = FFT_SIZE_LOG_MIN; log <= FFT_SIZE_LOG_MAX; ++log) {
+        if(size == (1u << log))
+            return log;
+    }
+    return -1;
+}
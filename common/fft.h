@@ -22,9 +22,16 @@
 #define FFT_BUFFER_SIZE_LOG 9
 #define FFT_BUFFER_SIZE (1 << FFT_BUFFER_SIZE_LOG)
 
+/* Range of transform sizes plans can be built for */
+#define FFT_SIZE_LOG_MIN 8
+#define FFT_SIZE_LOG_MAX 14
+#define FFT_SIZE_MIN (1 << FFT_SIZE_LOG_MIN)
+#define FFT_SIZE_MAX (1 << FFT_SIZE_LOG_MAX)
+
 /*
      modifications compared to original code:
      using float format for input data
+     transform size chosen at runtime through plans
 */
 
 #ifdef __cplusplus
@@ -32,11 +39,43 @@ extern "C" {
 #endif
 
 /* FFT library */
+    typedef struct _struct_fft_plan fft_plan;
+    fft_plan *fft_plan_create(unsigned int size);
+    void fft_plan_destroy(fft_plan *plan);
+    fft_plan *fft_plan_get(unsigned int size);
+    unsigned int fft_plan_size(const fft_plan *plan);
+
     typedef struct _struct_fft_state fft_state;
     fft_state *fft_init(void);
+    fft_state *fft_init_size(unsigned int size);
+    fft_state *fft_init_plan(const fft_plan *plan);
+    unsigned int fft_state_size(const fft_state *state);
+    void fft_set_window(fft_state *state, const float *window);
     void fft_perform(const float *input, float *output, fft_state * state);
+    void fft_perform_complex(const float *input, float *output_real, float *output_imag, fft_state * state);
+    void fft_perform_stereo(const float *left, const float *right, float *output_left, float *output_right, fft_state * state);
+    void fft_perform_stereo_complex(const float *left, const float *right, float *const *outputs, fft_state * state);
+    void fft_perform_complex_batch(const float *const *inputs, const float *const *windows, float *const *outputs, unsigned int count, fft_state * state);
+    void fft_perform_batch(const float *const *inputs, float *const *outputs, unsigned int count, fft_state * state);
+    unsigned int fft_batch_lanes(const fft_state *state);
     void fft_close(fft_state * state);
 
+/* Butterfly kernels */
+    typedef enum {
+        FFT_KERNEL_SCALAR,
+        FFT_KERNEL_SSE2,
+        FFT_KERNEL_AVX2,
+        FFT_KERNEL_AVX512,
+        FFT_KERNEL_COUNT
+    } fft_kernel;
+    const char *fft_kernel_name(fft_kernel kernel);
+    int fft_kernel_supported(fft_kernel kernel);
+    int fft_kernel_forced(void);
+    fft_kernel fft_get_kernel(void);
+    void fft_set_kernel(fft_kernel kernel);
+    fft_kernel fft_plan_get_kernel(const fft_plan *plan);
+    void fft_plan_set_kernel(fft_plan *plan, fft_kernel kernel);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,298 @@
+/* fft_kernel_simd.h: Vector butterfly kernel template
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Included by fft_kernels.c once per instruction set, with these defined:
+ *   FFT_KERNEL_NAME    name of the generated kernel
+ *   FFT_BATCH_NAME     name of the generated batch transform
+ *   FFT_KERNEL_TARGET  gcc target attribute string
+ *   FFT_VEC            vector type holding FFT_VEC_SIZE floats
+ *   FFT_VEC_SIZE       number of floats in FFT_VEC
+ *   FFT_VEC_LOAD, FFT_VEC_STORE, FFT_VEC_ADD, FFT_VEC_SUB, FFT_VEC_MUL,
+ *   FFT_VEC_SET1
+ *
+ * In the kernel, steps whose exchanges are fewer than FFT_VEC_SIZE run
+ * scalar, the others run two at a time as one radix-4 pass over contiguous
+ * butterfly factors.
+ *
+ * The batch transform takes FFT_VEC_SIZE frames at once, one per vector
+ * lane, so that every butterfly of every step fills a whole vector.  Frames
+ * are moved in and out of the lanes 4 x 4 values at a time, see
+ * fft_batch_prepare and fft_batch_store.
+ */
+
+#define FFT_VEC_CMUL(out_re, out_im, w_re, w_im, x_re, x_im) \
+    out_re = FFT_VEC_SUB(FFT_VEC_MUL(w_re, x_re), FFT_VEC_MUL(w_im, x_im)); \
+    out_im = FFT_VEC_ADD(FFT_VEC_MUL(w_re, x_im), FFT_VEC_MUL(w_im, x_re))
+
+__attribute__((target(FFT_KERNEL_TARGET)))
+static void FFT_KERNEL_NAME(float *re, float *im, unsigned int log, const float *twr, const float *twi)
+{
+    const unsigned int size = 1u << log;
+    unsigned int exchanges, group, j;
+
+    if(size < 4) {
+        fft_calculate_scalar(re, im, log, twr, twi);
+        return;
+    }
+
+    fft_radix4_first(re, im, size);
+    exchanges = 4;
+
+    for(; exchanges < FFT_VEC_SIZE && exchanges < size; exchanges <<= 1)
+        fft_radix2_step(re, im, size, exchanges, twr, twi);
+
+    /* Two steps per pass while both of them fit */
+    for(; (exchanges << 1) < size; exchanges <<= 2) {
+        const float *wa_re = twr + exchanges, *wa_im = twi + exchanges;
+        const float *wb_re = twr + 2 * exchanges, *wb_im = twi + 2 * exchanges;
+        const float *wc_re = wb_re + exchanges, *wc_im = wb_im + exchanges;
+
+        for(group = 0; group < size; group += exchanges << 2) {
+            float *r0 = re + group, *i0 = im + group;
+            float *r1 = r0 + exchanges, *i1 = i0 + exchanges;
+            float *r2 = r1 + exchanges, *i2 = i1 + exchanges;
+            float *r3 = r2 + exchanges, *i3 = i2 + exchanges;
+
+            for(j = 0; j < exchanges; j += FFT_VEC_SIZE) {
+                FFT_VEC a_re = FFT_VEC_LOAD(r0 + j), a_im = FFT_VEC_LOAD(i0 + j);
+                FFT_VEC b_re = FFT_VEC_LOAD(r1 + j), b_im = FFT_VEC_LOAD(i1 + j);
+                FFT_VEC c_re = FFT_VEC_LOAD(r2 + j), c_im = FFT_VEC_LOAD(i2 + j);
+                FFT_VEC d_re = FFT_VEC_LOAD(r3 + j), d_im = FFT_VEC_LOAD(i3 + j);
+                FFT_VEC w_re, w_im, t_re, t_im;
+
+                /* first step: (a, b) and (c, d) */
+                w_re = FFT_VEC_LOAD(wa_re + j);
+                w_im = FFT_VEC_LOAD(wa_im + j);
+                FFT_VEC_CMUL(t_re, t_im, w_re, w_im, b_re, b_im);
+                b_re = FFT_VEC_SUB(a_re, t_re);
+                b_im = FFT_VEC_SUB(a_im, t_im);
+                a_re = FFT_VEC_ADD(a_re, t_re);
+                a_im = FFT_VEC_ADD(a_im, t_im);
+
+                FFT_VEC_CMUL(t_re, t_im, w_re, w_im, d_re, d_im);
+                d_re = FFT_VEC_SUB(c_re, t_re);
+                d_im = FFT_VEC_SUB(c_im, t_im);
+                c_re = FFT_VEC_ADD(c_re, t_re);
+                c_im = FFT_VEC_ADD(c_im, t_im);
+
+                /* second step: (a, c) and (b, d) */
+                w_re = FFT_VEC_LOAD(wb_re + j);
+                w_im = FFT_VEC_LOAD(wb_im + j);
+                FFT_VEC_CMUL(t_re, t_im, w_re, w_im, c_re, c_im);
+                FFT_VEC_STORE(r2 + j, FFT_VEC_SUB(a_re, t_re));
+                FFT_VEC_STORE(i2 + j, FFT_VEC_SUB(a_im, t_im));
+                FFT_VEC_STORE(r0 + j, FFT_VEC_ADD(a_re, t_re));
+                FFT_VEC_STORE(i0 + j, FFT_VEC_ADD(a_im, t_im));
+
+                w_re = FFT_VEC_LOAD(wc_re + j);
+                w_im = FFT_VEC_LOAD(wc_im + j);
+                FFT_VEC_CMUL(t_re, t_im, w_re, w_im, d_re, d_im);
+                FFT_VEC_STORE(r3 + j, FFT_VEC_SUB(b_re, t_re));
+                FFT_VEC_STORE(i3 + j, FFT_VEC_SUB(b_im, t_im));
+                FFT_VEC_STORE(r1 + j, FFT_VEC_ADD(b_re, t_re));
+                FFT_VEC_STORE(i1 + j, FFT_VEC_ADD(b_im, t_im));
+            }
+        }
+    }
+
+    /* Odd step left over */
+    if(exchanges < size) {
+        const float *w_re_ptr = twr + exchanges, *w_im_ptr = twi + exchanges;
+        float *r1 = re + exchanges, *i1 = im + exchanges;
+
+        for(j = 0; j < exchanges; j += FFT_VEC_SIZE) {
+            FFT_VEC a_re = FFT_VEC_LOAD(re + j), a_im = FFT_VEC_LOAD(im + j);
+            FFT_VEC b_re = FFT_VEC_LOAD(r1 + j), b_im = FFT_VEC_LOAD(i1 + j);
+            FFT_VEC w_re = FFT_VEC_LOAD(w_re_ptr + j), w_im = FFT_VEC_LOAD(w_im_ptr + j);
+            FFT_VEC t_re, t_im;
+
+            FFT_VEC_CMUL(t_re, t_im, w_re, w_im, b_re, b_im);
+            FFT_VEC_STORE(r1 + j, FFT_VEC_SUB(a_re, t_re));
+            FFT_VEC_STORE(i1 + j, FFT_VEC_SUB(a_im, t_im));
+            FFT_VEC_STORE(re + j, FFT_VEC_ADD(a_re, t_re));
+            FFT_VEC_STORE(im + j, FFT_VEC_ADD(a_im, t_im));
+        }
+    }
+}
+
+/*
+ * Same as fft_perform on FFT_VEC_SIZE real frames of 2 ^ log samples.
+ * scratch holds 2 ^ log * FFT_VEC_SIZE floats, sample i of a frame is
+ * stored at i * FFT_VEC_SIZE + lane.
+ */
+__attribute__((target(FFT_KERNEL_TARGET)))
+static void FFT_BATCH_NAME(const float *const *inputs, float *const *outputs, unsigned int log,
+                           const unsigned int *bitReverse, const float *twr, const float *twi,
+                           const float *window, float *scratch)
+{
+    const unsigned int half = 1u << (log - 1);
+    float *re = scratch;
+    float *im = scratch + half * FFT_VEC_SIZE;
+    float lane_out[FFT_VEC_SIZE];
+    /* 4 values of every frame, to be stored together */
+    float block[4 * FFT_VEC_SIZE];
+    unsigned int i, lane, exchanges, group, j;
+
+    fft_batch_prepare(inputs, FFT_VEC_SIZE, 2 * half, bitReverse, window, re, im);
+
+    /* First two steps in one pass, their factors being 1 and i as in
+     * fft_radix4_first */
+    for(group = 0; group < half; group += 4) {
+        float *r0 = re + group * FFT_VEC_SIZE, *i0 = im + group * FFT_VEC_SIZE;
+        float *r1 = r0 + FFT_VEC_SIZE, *i1 = i0 + FFT_VEC_SIZE;
+        float *r2 = r1 + FFT_VEC_SIZE, *i2 = i1 + FFT_VEC_SIZE;
+        float *r3 = r2 + FFT_VEC_SIZE, *i3 = i2 + FFT_VEC_SIZE;
+        const FFT_VEC a_re = FFT_VEC_LOAD(r0), a_im = FFT_VEC_LOAD(i0);
+        const FFT_VEC b_re = FFT_VEC_LOAD(r1), b_im = FFT_VEC_LOAD(i1);
+        const FFT_VEC c_re = FFT_VEC_LOAD(r2), c_im = FFT_VEC_LOAD(i2);
+        const FFT_VEC d_re = FFT_VEC_LOAD(r3), d_im = FFT_VEC_LOAD(i3);
+        const FFT_VEC s_re = FFT_VEC_ADD(a_re, b_re), s_im = FFT_VEC_ADD(a_im, b_im);
+        const FFT_VEC t_re = FFT_VEC_SUB(a_re, b_re), t_im = FFT_VEC_SUB(a_im, b_im);
+        const FFT_VEC u_re = FFT_VEC_ADD(c_re, d_re), u_im = FFT_VEC_ADD(c_im, d_im);
+        const FFT_VEC v_re = FFT_VEC_SUB(c_re, d_re), v_im = FFT_VEC_SUB(c_im, d_im);
+
+        FFT_VEC_STORE(r0, FFT_VEC_ADD(s_re, u_re));
+        FFT_VEC_STORE(i0, FFT_VEC_ADD(s_im, u_im));
+        FFT_VEC_STORE(r2, FFT_VEC_SUB(s_re, u_re));
+        FFT_VEC_STORE(i2, FFT_VEC_SUB(s_im, u_im));
+        /* i * v */
+        FFT_VEC_STORE(r1, FFT_VEC_SUB(t_re, v_im));
+        FFT_VEC_STORE(i1, FFT_VEC_ADD(t_im, v_re));
+        FFT_VEC_STORE(r3, FFT_VEC_ADD(t_re, v_im));
+        FFT_VEC_STORE(i3, FFT_VEC_SUB(t_im, v_re));
+    }
+
+    /* Two steps per pass, as in the kernel above, but with the factors
+     * broadcast since all lanes are at the same point of their frame */
+    for(exchanges = 4; (exchanges << 1) < half; exchanges <<= 2) {
+        for(group = 0; group < half; group += exchanges << 2) {
+            for(j = 0; j < exchanges; ++j) {
+                float *r0 = re + (group + j) * FFT_VEC_SIZE, *i0 = im + (group + j) * FFT_VEC_SIZE;
+                float *r1 = r0 + exchanges * FFT_VEC_SIZE, *i1 = i0 + exchanges * FFT_VEC_SIZE;
+                float *r2 = r1 + exchanges * FFT_VEC_SIZE, *i2 = i1 + exchanges * FFT_VEC_SIZE;
+                float *r3 = r2 + exchanges * FFT_VEC_SIZE, *i3 = i2 + exchanges * FFT_VEC_SIZE;
+                FFT_VEC a_re = FFT_VEC_LOAD(r0), a_im = FFT_VEC_LOAD(i0);
+                FFT_VEC b_re = FFT_VEC_LOAD(r1), b_im = FFT_VEC_LOAD(i1);
+                FFT_VEC c_re = FFT_VEC_LOAD(r2), c_im = FFT_VEC_LOAD(i2);
+                FFT_VEC d_re = FFT_VEC_LOAD(r3), d_im = FFT_VEC_LOAD(i3);
+                FFT_VEC w_re, w_im, t_re, t_im;
+
+                w_re = FFT_VEC_SET1(twr[exchanges + j]);
+                w_im = FFT_VEC_SET1(twi[exchanges + j]);
+                FFT_VEC_CMUL(t_re, t_im, w_re, w_im, b_re, b_im);
+                b_re = FFT_VEC_SUB(a_re, t_re);
+                b_im = FFT_VEC_SUB(a_im, t_im);
+                a_re = FFT_VEC_ADD(a_re, t_re);
+                a_im = FFT_VEC_ADD(a_im, t_im);
+
+                FFT_VEC_CMUL(t_re, t_im, w_re, w_im, d_re, d_im);
+                d_re = FFT_VEC_SUB(c_re, t_re);
+                d_im = FFT_VEC_SUB(c_im, t_im);
+                c_re = FFT_VEC_ADD(c_re, t_re);
+                c_im = FFT_VEC_ADD(c_im, t_im);
+
+                w_re = FFT_VEC_SET1(twr[2 * exchanges + j]);
+                w_im = FFT_VEC_SET1(twi[2 * exchanges + j]);
+                FFT_VEC_CMUL(t_re, t_im, w_re, w_im, c_re, c_im);
+                FFT_VEC_STORE(r2, FFT_VEC_SUB(a_re, t_re));
+                FFT_VEC_STORE(i2, FFT_VEC_SUB(a_im, t_im));
+                FFT_VEC_STORE(r0, FFT_VEC_ADD(a_re, t_re));
+                FFT_VEC_STORE(i0, FFT_VEC_ADD(a_im, t_im));
+
+                w_re = FFT_VEC_SET1(twr[3 * exchanges + j]);
+                w_im = FFT_VEC_SET1(twi[3 * exchanges + j]);
+                FFT_VEC_CMUL(t_re, t_im, w_re, w_im, d_re, d_im);
+                FFT_VEC_STORE(r3, FFT_VEC_SUB(b_re, t_re));
+                FFT_VEC_STORE(i3, FFT_VEC_SUB(b_im, t_im));
+                FFT_VEC_STORE(r1, FFT_VEC_ADD(b_re, t_re));
+                FFT_VEC_STORE(i1, FFT_VEC_ADD(b_im, t_im));
+            }
+        }
+    }
+
+    /* Odd step left over */
+    if(exchanges < half) {
+        for(j = 0; j < exchanges; ++j) {
+            float *r0 = re + j * FFT_VEC_SIZE, *i0 = im + j * FFT_VEC_SIZE;
+            float *r1 = r0 + exchanges * FFT_VEC_SIZE, *i1 = i0 + exchanges * FFT_VEC_SIZE;
+            FFT_VEC a_re = FFT_VEC_LOAD(r0), a_im = FFT_VEC_LOAD(i0);
+            FFT_VEC b_re = FFT_VEC_LOAD(r1), b_im = FFT_VEC_LOAD(i1);
+            FFT_VEC w_re = FFT_VEC_SET1(twr[exchanges + j]), w_im = FFT_VEC_SET1(twi[exchanges + j]);
+            FFT_VEC t_re, t_im;
+
+            FFT_VEC_CMUL(t_re, t_im, w_re, w_im, b_re, b_im);
+            FFT_VEC_STORE(r1, FFT_VEC_SUB(a_re, t_re));
+            FFT_VEC_STORE(i1, FFT_VEC_SUB(a_im, t_im));
+            FFT_VEC_STORE(r0, FFT_VEC_ADD(a_re, t_re));
+            FFT_VEC_STORE(i0, FFT_VEC_ADD(a_im, t_im));
+        }
+    }
+
+    /* Same split as fft_output, see there */
+    {
+        const FFT_VEC z_re = FFT_VEC_LOAD(re), z_im = FFT_VEC_LOAD(im);
+        const FFT_VEC quarter = FFT_VEC_SET1(0.25f);
+        FFT_VEC t = FFT_VEC_ADD(z_re, z_im);
+        FFT_VEC_STORE(lane_out, FFT_VEC_MUL(FFT_VEC_MUL(t, t), quarter));
+        for(lane = 0; lane < FFT_VEC_SIZE; ++lane)
+            outputs[lane][0] = lane_out[lane];
+
+        t = FFT_VEC_SUB(z_re, z_im);
+        FFT_VEC_STORE(lane_out, FFT_VEC_MUL(FFT_VEC_MUL(t, t), quarter));
+        for(lane = 0; lane < FFT_VEC_SIZE; ++lane)
+            outputs[lane][half] = lane_out[lane];
+    }
+
+    for(i = 1; i < half; ++i) {
+        const FFT_VEC one_half = FFT_VEC_SET1(0.5f);
+        const FFT_VEC k_re = FFT_VEC_LOAD(re + i * FFT_VEC_SIZE), k_im = FFT_VEC_LOAD(im + i * FFT_VEC_SIZE);
+        const FFT_VEC m_re = FFT_VEC_LOAD(re + (half - i) * FFT_VEC_SIZE), m_im = FFT_VEC_LOAD(im + (half - i) * FFT_VEC_SIZE);
+        const FFT_VEC w_re = FFT_VEC_SET1(twr[half + i]), w_im = FFT_VEC_SET1(twi[half + i]);
+        const FFT_VEC even_re = FFT_VEC_MUL(FFT_VEC_ADD(k_re, m_re), one_half);
+        const FFT_VEC even_im = FFT_VEC_MUL(FFT_VEC_SUB(k_im, m_im), one_half);
+        const FFT_VEC odd_re = FFT_VEC_MUL(FFT_VEC_ADD(k_im, m_im), one_half);
+        const FFT_VEC odd_im = FFT_VEC_MUL(FFT_VEC_SUB(m_re, k_re), one_half);
+        FFT_VEC t_re, t_im;
+
+        FFT_VEC_CMUL(t_re, t_im, w_re, w_im, odd_re, odd_im);
+        t_re = FFT_VEC_ADD(even_re, t_re);
+        t_im = FFT_VEC_ADD(even_im, t_im);
+        FFT_VEC_STORE(block + ((i - 1) & 3) * FFT_VEC_SIZE, FFT_VEC_ADD(FFT_VEC_MUL(t_re, t_re), FFT_VEC_MUL(t_im, t_im)));
+        if(((i - 1) & 3) == 3)
+            fft_batch_store(block, FFT_VEC_SIZE, outputs, i - 3);
+    }
+
+    /* Up to 3 values of each frame left over */
+    for(i = half - ((half - 1) & 3); i < half; ++i) {
+        for(lane = 0; lane < FFT_VEC_SIZE; ++lane)
+            outputs[lane][i] = block[((i - 1) & 3) * FFT_VEC_SIZE + lane];
+    }
+}
+
+#undef FFT_VEC_CMUL
+#undef FFT_BATCH_NAME
+#undef FFT_KERNEL_NAME
+#undef FFT_KERNEL_TARGET
+#undef FFT_VEC
+#undef FFT_VEC_SIZE
+#undef FFT_VEC_LOAD
+#undef FFT_VEC_STORE
+#undef FFT_VEC_ADD
+#undef FFT_VEC_SUB
+#undef FFT_VEC_MUL
+#undef FFT_VEC_SET1
@@ -0,0 +1,329 @@
+/* fft_kernels.c: Vectorised butterfly kernels and their runtime selection
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * The kernel is chosen from what the CPU supports, widest first.
+ * Setting the environment variable FFT_KERNEL to one of "scalar", "sse2",
+ * "avx2" or "avx512" forces that kernel when the CPU can run it.
+ */
+
+#include "fft_kernels.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define FFT_HAVE_X86_KERNELS
+#  include <immintrin.h>
+#endif
+
+static const char *kernel_names[FFT_KERNEL_COUNT] = {
+    "scalar",
+    "sse2",
+    "avx2",
+    "avx512"
+};
+
+#ifdef FFT_HAVE_X86_KERNELS
+/*
+ * First two steps in one pass.  Their butterfly factors are 1 and i, so
+ * they need no multiplications.
+ */
+static void fft_radix4_first(float *re, float *im, unsigned int size)
+{
+    unsigned int k;
+    float a_re, a_im, b_re, b_im, c_re, c_im, d_re, d_im;
+
+    for(k = 0; k < size; k += 4) {
+        a_re = re[k] + re[k + 1];
+        a_im = im[k] + im[k + 1];
+        b_re = re[k] - re[k + 1];
+        b_im = im[k] - im[k + 1];
+        c_re = re[k + 2] + re[k + 3];
+        c_im = im[k + 2] + im[k + 3];
+        d_re = re[k + 2] - re[k + 3];
+        d_im = im[k + 2] - im[k + 3];
+
+        re[k] = a_re + c_re;
+        im[k] = a_im + c_im;
+        re[k + 2] = a_re - c_re;
+        im[k + 2] = a_im - c_im;
+        /* i * d */
+        re[k + 1] = b_re - d_im;
+        im[k + 1] = b_im + d_re;
+        re[k + 3] = b_re + d_im;
+        im[k + 3] = b_im - d_re;
+    }
+}
+
+/*
+ * One scalar step, for steps too narrow to fill a vector.
+ */
+static void fft_radix2_step(float *re, float *im, unsigned int size, unsigned int exchanges, const float *twr, const float *twi)
+{
+    unsigned int group, j;
+    float tmp_real, tmp_imag;
+
+    for(group = 0; group < size; group += exchanges << 1) {
+        float *r1 = re + group + exchanges, *i1 = im + group + exchanges;
+        float *r0 = re + group, *i0 = im + group;
+
+        for(j = 0; j < exchanges; ++j) {
+            tmp_real = twr[exchanges + j] * r1[j] - twi[exchanges + j] * i1[j];
+            tmp_imag = twr[exchanges + j] * i1[j] + twi[exchanges + j] * r1[j];
+            r1[j] = r0[j] - tmp_real;
+            i1[j] = i0[j] - tmp_imag;
+            r0[j] += tmp_real;
+            i0[j] += tmp_imag;
+        }
+    }
+}
+
+/*
+ * The packing of fft_prepare for a batch of lanes frames, lanes being a
+ * multiple of 4: sample i of a frame goes to (i * lanes + lane).  Frames
+ * are read in order, 4 samples of 4 frames at a time, and transposed so
+ * that each sample of the 4 frames is stored at once, where its pair
+ * lands after bit reversal.
+ */
+__attribute__((target("sse2"), always_inline))
+static inline void fft_batch_prepare(const float *const *inputs, unsigned int lanes, unsigned int size,
+                              const unsigned int *bitReverse, const float *window, float *re, float *im)
+{
+    unsigned int i, lane;
+    __m128 factors = _mm_set1_ps(32767.0f);
+
+    for(i = 0; i < size; i += 4) {
+        /* bitReverse is its own inverse, over one bit less for pairs */
+        float *re0 = re + (bitReverse[i / 2] / 2) * lanes, *im0 = im + (bitReverse[i / 2] / 2) * lanes;
+        float *re1 = re + (bitReverse[i / 2 + 1] / 2) * lanes, *im1 = im + (bitReverse[i / 2 + 1] / 2) * lanes;
+        __m128 f0, f1, f2, f3;
+
+        if(window)
+            factors = _mm_mul_ps(_mm_loadu_ps(window + i), _mm_set1_ps(32767.0f));
+        f0 = _mm_shuffle_ps(factors, factors, _MM_SHUFFLE(0, 0, 0, 0));
+        f1 = _mm_shuffle_ps(factors, factors, _MM_SHUFFLE(1, 1, 1, 1));
+        f2 = _mm_shuffle_ps(factors, factors, _MM_SHUFFLE(2, 2, 2, 2));
+        f3 = _mm_shuffle_ps(factors, factors, _MM_SHUFFLE(3, 3, 3, 3));
+
+        for(lane = 0; lane < lanes; lane += 4) {
+            __m128 x0 = _mm_loadu_ps(inputs[lane] + i);
+            __m128 x1 = _mm_loadu_ps(inputs[lane + 1] + i);
+            __m128 x2 = _mm_loadu_ps(inputs[lane + 2] + i);
+            __m128 x3 = _mm_loadu_ps(inputs[lane + 3] + i);
+
+            _MM_TRANSPOSE4_PS(x0, x1, x2, x3);
+            _mm_storeu_ps(re0 + lane, _mm_mul_ps(x0, f0));
+            _mm_storeu_ps(im0 + lane, _mm_mul_ps(x1, f1));
+            _mm_storeu_ps(re1 + lane, _mm_mul_ps(x2, f2));
+            _mm_storeu_ps(im1 + lane, _mm_mul_ps(x3, f3));
+        }
+    }
+}
+
+/*
+ * The other way round, from 4 rows of lanes values each to 4 values of
+ * every frame, stored at outputs[lane] + first.
+ */
+__attribute__((target("sse2"), always_inline))
+static inline void fft_batch_store(const float *block, unsigned int lanes, float *const *outputs, unsigned int first)
+{
+    unsigned int lane;
+
+    for(lane = 0; lane < lanes; lane += 4) {
+        __m128 x0 = _mm_loadu_ps(block + lane);
+        __m128 x1 = _mm_loadu_ps(block + lanes + lane);
+        __m128 x2 = _mm_loadu_ps(block + 2 * lanes + lane);
+        __m128 x3 = _mm_loadu_ps(block + 3 * lanes + lane);
+
+        _MM_TRANSPOSE4_PS(x0, x1, x2, x3);
+        _mm_storeu_ps(outputs[lane] + first, x0);
+        _mm_storeu_ps(outputs[lane + 1] + first, x1);
+        _mm_storeu_ps(outputs[lane + 2] + first, x2);
+        _mm_storeu_ps(outputs[lane + 3] + first, x3);
+    }
+}
+
+#define FFT_KERNEL_NAME   fft_calculate_sse2
+#define FFT_BATCH_NAME    fft_batch_sse2
+#define FFT_KERNEL_TARGET "sse2"
+#define FFT_VEC           __m128
+#define FFT_VEC_SIZE      4
+#define FFT_VEC_LOAD      _mm_loadu_ps
+#define FFT_VEC_STORE     _mm_storeu_ps
+#define FFT_VEC_ADD       _mm_add_ps
+#define FFT_VEC_SUB       _mm_sub_ps
+#define FFT_VEC_MUL       _mm_mul_ps
+#define FFT_VEC_SET1      _mm_set1_ps
+#include "fft_kernel_simd.h"
+
+#define FFT_KERNEL_NAME   fft_calculate_avx2
+#define FFT_BATCH_NAME    fft_batch_avx2
+#define FFT_KERNEL_TARGET "avx2"
+#define FFT_VEC           __m256
+#define FFT_VEC_SIZE      8
+#define FFT_VEC_LOAD      _mm256_loadu_ps
+#define FFT_VEC_STORE     _mm256_storeu_ps
+#define FFT_VEC_ADD       _mm256_add_ps
+#define FFT_VEC_SUB       _mm256_sub_ps
+#define FFT_VEC_MUL       _mm256_mul_ps
+#define FFT_VEC_SET1      _mm256_set1_ps
+#include "fft_kernel_simd.h"
+
+#define FFT_KERNEL_NAME   fft_calculate_avx512
+#define FFT_BATCH_NAME    fft_batch_avx512
+#define FFT_KERNEL_TARGET "avx512f"
+#define FFT_VEC           __m512
+#define FFT_VEC_SIZE      16
+#define FFT_VEC_LOAD      _mm512_loadu_ps
+#define FFT_VEC_STORE     _mm512_storeu_ps
+#define FFT_VEC_ADD       _mm512_add_ps
+#define FFT_VEC_SUB       _mm512_sub_ps
+#define FFT_VEC_MUL       _mm512_mul_ps
+#define FFT_VEC_SET1      _mm512_set1_ps
+#include "fft_kernel_simd.h"
+#endif
+
+const char *fft_kernel_name(fft_kernel kernel)
+{
+    if(kernel < 0 || kernel >= FFT_KERNEL_COUNT)
+        return 0;
+    return kernel_names[kernel];
+}
+
+/*
+ * Returns non zero if the CPU (and OS) can run the kernel.
+ */
+int fft_kernel_supported(fft_kernel kernel)
+{
+    switch(kernel) {
+    case FFT_KERNEL_SCALAR:
+        return 1;
+#ifdef FFT_HAVE_X86_KERNELS
+    case FFT_KERNEL_SSE2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+    case FFT_KERNEL_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    case FFT_KERNEL_AVX512:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+        return 0;
+    }
+}
+
+fft_kernel_func fft_kernel_get(fft_kernel kernel)
+{
+    switch(kernel) {
+#ifdef FFT_HAVE_X86_KERNELS
+    case FFT_KERNEL_SSE2: return fft_calculate_sse2;
+    case FFT_KERNEL_AVX2: return fft_calculate_avx2;
+    case FFT_KERNEL_AVX512: return fft_calculate_avx512;
+#endif
+    default: return fft_calculate_scalar;
+    }
+}
+
+/*
+ * Whether the batch transform of a kernel beats looping its single frame
+ * transform, at every plan size.  Measured with 64 windowed frames, batch
+ * over loop throughput:
+ *   points      sse2       avx2       avx512
+ *   256         2.0x       3.4-3.5x   4.8-5.0x
+ *   512         1.8-2.0x   3.6x       4.5-4.7x
+ *   1024        1.9-2.0x   2.6-3.0x   3.7x
+ *   2048-16384  1.4-1.7x   2.1-2.8x   2.6-2.8x
+ * Only avx2 up to 512 points and avx512 up to 1024 points reach 3x.  The
+ * single frame sse2 kernel already fills its 4 lanes, so that batch only
+ * saves the packing and the first steps.  Above 1024 points the frames
+ * in the lanes outgrow L1.  A kernel whose batch stops paying off is
+ * turned off here and its frames go through fft_perform.
+ */
+static const int batch_faster[FFT_KERNEL_COUNT] = {
+    0,
+    1,
+    1,
+    1
+};
+
+/*
+ * Returns the batch transform matching a kernel and its number of lanes,
+ * or NULL for kernels without one or whose batch is not faster.
+ */
+fft_batch_func fft_batch_get(fft_kernel kernel, unsigned int *lanes)
+{
+    if(kernel < 0 || kernel >= FFT_KERNEL_COUNT || !batch_faster[kernel]) {
+        *lanes = 1;
+        return 0;
+    }
+
+    switch(kernel) {
+#ifdef FFT_HAVE_X86_KERNELS
+    case FFT_KERNEL_SSE2: *lanes = 4; return fft_batch_sse2;
+    case FFT_KERNEL_AVX2: *lanes = 8; return fft_batch_avx2;
+    case FFT_KERNEL_AVX512: *lanes = 16; return fft_batch_avx512;
+#endif
+    default: *lanes = 1; return 0;
+    }
+}
+
+/*
+ * Returns the kernel named by FFT_KERNEL, or FFT_KERNEL_COUNT if there is
+ * none the CPU can run.
+ */
+static fft_kernel fft_kernel_from_env(void)
+{
+    const char *forced = getenv("FFT_KERNEL");
+    int kernel;
+
+    if(forced) {
+        for(kernel = 0; kernel < FFT_KERNEL_COUNT; ++kernel) {
+            if(!strcmp(forced, kernel_names[kernel]) && fft_kernel_supported((fft_kernel) kernel))
+                return (fft_kernel) kernel;
+        }
+    }
+    return FFT_KERNEL_COUNT;
+}
+
+/*
+ * Returns non zero if FFT_KERNEL forces a kernel, which then takes
+ * precedence over any tuning.
+ */
+int fft_kernel_forced(void)
+{
+    return fft_kernel_from_env() != FFT_KERNEL_COUNT;
+}
+
+/*
+ * Picks the kernel named by FFT_KERNEL, or else the widest one supported.
+ */
+fft_kernel fft_kernel_select(void)
+{
+    int kernel = fft_kernel_from_env();
+
+    if(kernel != FFT_KERNEL_COUNT)
+        return (fft_kernel) kernel;
+
+    for(kernel = FFT_KERNEL_COUNT - 1; kernel > FFT_KERNEL_SCALAR; --kernel) {
+        if(fft_kernel_supported((fft_kernel) kernel))
+            return (fft_kernel) kernel;
+    }
+    return FFT_KERNEL_SCALAR;
+}
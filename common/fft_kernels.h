@@ -0,0 +1,44 @@
+/* fft_kernels.h: Butterfly kernels shared between fft.c and fft_kernels.c
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _FFT_KERNELS_H_
+#define _FFT_KERNELS_H_
+
+#include "fft.h"
+
+/*
+ * A kernel performs the in-place FFT of 2 ^ log bit reversed points.
+ * twr / twi are the per step butterfly factors, see fft.c.
+ */
+typedef void (*fft_kernel_func)(float *re, float *im, unsigned int log, const float *twr, const float *twi);
+
+/*
+ * A batch transform performs fft_perform on as many frames as it has lanes.
+ * window is the state's window or NULL, scratch holds 2 ^ log floats per
+ * lane.
+ */
+typedef void (*fft_batch_func)(const float *const *inputs, float *const *outputs, unsigned int log,
+                               const unsigned int *bitReverse, const float *twr, const float *twi,
+                               const float *window, float *scratch);
+
+void fft_calculate_scalar(float *re, float *im, unsigned int log, const float *twr, const float *twi);
+
+fft_kernel_func fft_kernel_get(fft_kernel kernel);
+fft_batch_func fft_batch_get(fft_kernel kernel, unsigned int *lanes);
+fft_kernel fft_kernel_select(void);
+
+#endif  /* _FFT_KERNELS_H_ */
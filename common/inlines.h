@@ -7,33 +7,45 @@
 /*
      modifications compared to original code:
      using float format
+     levels in dB through spectrum_levels
 */
 
 #ifndef INLINES_H
 #define INLINES_H
 
 #include "fft.h"
+#include "spectrum.h"
 #include <math.h>
 #include <string.h>
 
 // *fast* convenience functions
-static inline void calc_freq(short* dest, float *src)
+// count power values scaled like those of a size point transform to levels in
+// [0, 1]: floor_db dBFS maps to 0 and floor_db + range_db to 1
+static inline void calc_levels(float *dest, const float *power, unsigned int count, unsigned int size, float floor_db, float range_db)
 {
-    static fft_state *state = nullptr;
-    float tmp_out[257];
-    int i;
+    // 20 log10 of the bin magnitude of a full scale sine
+    const float full_db = 20.0f * log10f(32767.0f * size / 2);
 
-    if(!state)
-    {
-        state = fft_init();
-    }
+    spectrum_levels(power, dest, count, 10.0f * log10f(2.0f) / range_db, -(full_db + floor_db) / range_db);
+}
+
+// state is a FFT_BUFFER_SIZE point state from fft_init, owned by the caller
+static inline void calc_freq(float *dest, float *src, fft_state *state, float floor_db, float range_db)
+{
+    float tmp_out[FFT_BUFFER_SIZE / 2 + 1];
 
     fft_perform(src, tmp_out, state);
+    calc_levels(dest, tmp_out + 1, FFT_BUFFER_SIZE / 2, FFT_BUFFER_SIZE, floor_db, range_db);
+}
 
-    for(i = 0; i < 256; ++i)
-    {
-        dest[i] = ((int) sqrt(tmp_out[i + 1])) >> 8;
-    }
+// both channels through a single transform
+static inline void calc_freq_stereo(float *destl, float *destr, float *left, float *right, fft_state *state, float floor_db, float range_db)
+{
+    float tmp_outl[FFT_BUFFER_SIZE / 2 + 1], tmp_outr[FFT_BUFFER_SIZE / 2 + 1];
+
+    fft_perform_stereo(left, right, tmp_outl, tmp_outr, state);
+    calc_levels(destl, tmp_outl + 1, FFT_BUFFER_SIZE / 2, FFT_BUFFER_SIZE, floor_db, range_db);
+    calc_levels(destr, tmp_outr + 1, FFT_BUFFER_SIZE / 2, FFT_BUFFER_SIZE, floor_db, range_db);
 }
 
 static inline void stereo_from_multichannel(float *l, float *r, float *s, long cnt, int chan)
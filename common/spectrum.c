@@ -0,0 +1,459 @@
+/* spectrum.c: Conversion of power spectra into display levels
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * log2(x) is split into the float's exponent e and mantissa 1 + t, t in
+ * [0, 1).  log2(1 + t) is approximated by a quartic through t = 0 whose
+ * coefficients were fitted for the smallest largest error over [0, 1), see
+ * SPECTRUM_LOG2_ERROR.  Zero maps to -127 and so does every denormal below
+ * 2 ^ -127, which is far under any level worth drawing.
+ *
+ * A layout maps levels onto display rows.  Row i spans the fractional bins
+ * edges[i] to edges[i + 1].  Rows covering at least one whole bin take the
+ * largest level of their bins, narrower rows interpolate between the two
+ * bins around their centre instead of repeating one bin.  The segments are
+ * kept as separate start / length / weight arrays, a length of 0 marking an
+ * interpolated row.
+ *
+ * spectrum_levels_features takes the features along in the vector loop.  The
+ * rolloff needs the total power before it can be found, so the loop also
+ * keeps the running total after every four bins and a binary search over
+ * these leaves at most four bins to look at afterwards.
+ *
+ * spectrum_decimate runs a halfband lowpass at every second sample.  All
+ * even taps of such a filter but the centre one, which is 0.5, are 0, so
+ * only the odd ones are given and the sums are taken over pairs of samples
+ * around the centre.
+ */
+
+#include "spectrum.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+struct _struct_spectrum_layout {
+    unsigned int rows;
+    unsigned int *start;
+    unsigned int *length;
+    float *weight;
+};
+
+#define LOG2_C1  1.43901468f
+#define LOG2_C2 -0.679944044f
+#define LOG2_C3  0.325595665f
+#define LOG2_C4 -0.0847686379f
+
+/*
+ * Fast log2 of a non negative, finite x.
+ */
+float spectrum_log2(float x)
+{
+    uint32_t bits;
+    float exponent, t;
+
+    memcpy(&bits, &x, sizeof(bits));
+    exponent = (float) ((int) (bits >> 23) - 127);
+    bits = (bits & 0x007fffff) | 0x3f800000;
+    memcpy(&t, &bits, sizeof(t));
+    t -= 1.0f;
+
+    return exponent + t * (LOG2_C1 + t * (LOG2_C2 + t * (LOG2_C3 + t * LOG2_C4)));
+}
+
+/*
+ * levels[i] = scale * log2(power[i]) + offset, clamped to [0, 1].
+ * With scale = 10 log10(2) / range and offset = -floor / range this maps
+ * floor dB to 0 and floor + range dB to 1 in a single pass.
+ */
+void spectrum_levels(const float *power, float *levels, unsigned int count, float scale, float offset)
+{
+    unsigned int i = 0;
+    float level;
+
+#if defined(__SSE2__)
+    const __m128i mantissa = _mm_set1_epi32(0x007fffff);
+    const __m128i one = _mm_set1_epi32(0x3f800000);
+    const __m128i bias = _mm_set1_epi32(127);
+    const __m128 c1 = _mm_set1_ps(LOG2_C1), c2 = _mm_set1_ps(LOG2_C2);
+    const __m128 c3 = _mm_set1_ps(LOG2_C3), c4 = _mm_set1_ps(LOG2_C4);
+    const __m128 vscale = _mm_set1_ps(scale), voffset = _mm_set1_ps(offset);
+    const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(1.0f);
+
+    for(; i + 4 <= count; i += 4) {
+        const __m128i bits = _mm_castps_si128(_mm_loadu_ps(power + i));
+        const __m128 exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), bias));
+        const __m128 t = _mm_sub_ps(_mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, mantissa), one)), hi);
+        __m128 poly = _mm_add_ps(c3, _mm_mul_ps(t, c4));
+
+        poly = _mm_add_ps(c2, _mm_mul_ps(t, poly));
+        poly = _mm_add_ps(c1, _mm_mul_ps(t, poly));
+        poly = _mm_add_ps(exponent, _mm_mul_ps(t, poly));
+        poly = _mm_add_ps(voffset, _mm_mul_ps(vscale, poly));
+        _mm_storeu_ps(levels + i, _mm_min_ps(_mm_max_ps(poly, lo), hi));
+    }
+#endif
+
+    for(; i < count; ++i) {
+        level = scale * spectrum_log2(power[i]) + offset;
+        levels[i] = level < 0.0f ? 0.0f : (level > 1.0f ? 1.0f : level);
+    }
+}
+
+/*
+ * Same as spectrum_levels, taking the features of the spectrum in the same
+ * pass.  history holds the log2 power of every bin from the last call, not
+ * below that of level 0, and is updated.  partial is scratch room for
+ * (count + 3) / 4 running sums of the power, from which the rolloff is
+ * found without a second pass.
+ */
+void spectrum_levels_features(const float *power, float *levels, unsigned int count, float scale, float offset,
+                              float *history, float *partial, spectrum_features *features)
+{
+    const float floor = -offset / scale;
+    unsigned int i = 0, blocks = 0, low, high;
+    float total = 0.0f, weighted = 0.0f, logs = 0.0f, rise = 0.0f;
+    float lg, level, target, sum;
+
+#if defined(__SSE2__)
+    const __m128i mantissa = _mm_set1_epi32(0x007fffff);
+    const __m128i one = _mm_set1_epi32(0x3f800000);
+    const __m128i bias = _mm_set1_epi32(127);
+    const __m128 c1 = _mm_set1_ps(LOG2_C1), c2 = _mm_set1_ps(LOG2_C2);
+    const __m128 c3 = _mm_set1_ps(LOG2_C3), c4 = _mm_set1_ps(LOG2_C4);
+    const __m128 vscale = _mm_set1_ps(scale), voffset = _mm_set1_ps(offset);
+    const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(1.0f);
+    const __m128 vfloor = _mm_set1_ps(floor), four = _mm_set1_ps(4.0f);
+    __m128 vindex = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    __m128 vweighted = _mm_setzero_ps(), vlogs = _mm_setzero_ps(), vrise = _mm_setzero_ps();
+    float sums[4];
+
+    for(; i + 4 <= count; i += 4) {
+        const __m128 p = _mm_loadu_ps(power + i);
+        const __m128i bits = _mm_castps_si128(p);
+        const __m128 exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), bias));
+        const __m128 t = _mm_sub_ps(_mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, mantissa), one)), hi);
+        __m128 poly = _mm_add_ps(c3, _mm_mul_ps(t, c4)), block;
+
+        poly = _mm_add_ps(c2, _mm_mul_ps(t, poly));
+        poly = _mm_add_ps(c1, _mm_mul_ps(t, poly));
+        poly = _mm_add_ps(exponent, _mm_mul_ps(t, poly));
+        _mm_storeu_ps(levels + i, _mm_min_ps(_mm_max_ps(_mm_add_ps(voffset, _mm_mul_ps(vscale, poly)), lo), hi));
+
+        vweighted = _mm_add_ps(vweighted, _mm_mul_ps(p, vindex));
+        vindex = _mm_add_ps(vindex, four);
+        vlogs = _mm_add_ps(vlogs, poly);
+        poly = _mm_max_ps(poly, vfloor);
+        vrise = _mm_add_ps(vrise, _mm_max_ps(_mm_sub_ps(poly, _mm_loadu_ps(history + i)), lo));
+        _mm_storeu_ps(history + i, poly);
+
+        block = _mm_add_ps(p, _mm_movehl_ps(p, p));
+        block = _mm_add_ss(block, _mm_shuffle_ps(block, block, 1));
+        total += _mm_cvtss_f32(block);
+        partial[blocks++] = total;
+    }
+
+    _mm_storeu_ps(sums, vweighted);
+    weighted = sums[0] + sums[1] + sums[2] + sums[3];
+    _mm_storeu_ps(sums, vlogs);
+    logs = sums[0] + sums[1] + sums[2] + sums[3];
+    _mm_storeu_ps(sums, vrise);
+    rise = sums[0] + sums[1] + sums[2] + sums[3];
+#endif
+
+    for(; i < count; ++i) {
+        lg = spectrum_log2(power[i]);
+        level = scale * lg + offset;
+        levels[i] = level < 0.0f ? 0.0f : (level > 1.0f ? 1.0f : level);
+
+        total += power[i];
+        weighted += power[i] * i;
+        logs += lg;
+        if(lg < floor)
+            lg = floor;
+        if(lg > history[i])
+            rise += lg - history[i];
+        history[i] = lg;
+
+        if((i & 3) == 3 || i + 1 == count)
+            partial[blocks++] = total;
+    }
+
+    features->flux = count ? rise / count : 0.0f;
+    if(total <= 0.0f) {
+        features->centroid = 0.0f;
+        features->rolloff = 0.0f;
+        features->flatness = 0.0f;
+        return;
+    }
+
+    features->centroid = weighted / total;
+    features->flatness = exp2f(logs / count) * count / total;
+    if(features->flatness > 1.0f)
+        features->flatness = 1.0f;
+
+    /* first block reaching the target, then the bin within it */
+    target = SPECTRUM_ROLLOFF * total;
+    low = 0;
+    high = blocks - 1;
+    while(low < high) {
+        const unsigned int middle = (low + high) / 2;
+        if(partial[middle] < target)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    sum = low ? partial[low - 1] : 0.0f;
+    for(i = 4 * low; i + 1 < count && sum + power[i] < target; ++i)
+        sum += power[i];
+    features->rolloff = power[i] > 0.0f ? i + (target - sum) / power[i] : (float) i;
+}
+
+/*
+ * Builds the layout for rows rows over bins levels from rows + 1 ascending
+ * fractional bin edges.  Returns NULL on error.
+ */
+spectrum_layout *spectrum_layout_create(const float *edges, unsigned int rows, unsigned int bins)
+{
+    spectrum_layout *layout;
+    unsigned int i, start, end;
+    float centre;
+
+    if(!rows || bins < 2)
+        return 0;
+
+    layout = (spectrum_layout *) malloc(sizeof(spectrum_layout) + rows * (2 * sizeof(unsigned int) + sizeof(float)));
+    if(!layout)
+        return 0;
+
+    layout->rows = rows;
+    layout->start = (unsigned int *) (layout + 1);
+    layout->length = layout->start + rows;
+    layout->weight = (float *) (layout->length + rows);
+
+    for(i = 0; i < rows; ++i) {
+        start = edges[i] > 0.0f ? (unsigned int) edges[i] : 0;
+        end = edges[i + 1] > 0.0f ? (unsigned int) edges[i + 1] : 0;
+        if(end > bins)
+            end = bins;
+
+        if(end > start) {
+            layout->start[i] = start;
+            layout->length[i] = end - start;
+            layout->weight[i] = 0.0f;
+            continue;
+        }
+
+        centre = (edges[i] + edges[i + 1]) * 0.5f;
+        if(centre < 0.0f)
+            centre = 0.0f;
+        if(centre > bins - 1)
+            centre = bins - 1;
+        start = (unsigned int) centre;
+        if(start > bins - 2)
+            start = bins - 2;
+        layout->start[i] = start;
+        layout->length[i] = 0;
+        layout->weight[i] = centre - start;
+    }
+
+    return layout;
+}
+
+void spectrum_layout_destroy(spectrum_layout *layout)
+{
+    free(layout);
+}
+
+unsigned int spectrum_layout_rows(const spectrum_layout *layout)
+{
+    return layout->rows;
+}
+
+/*
+ * Largest of count > 0 levels.
+ */
+static inline float spectrum_max(const float *levels, unsigned int count)
+{
+    unsigned int i = 0;
+    float max = levels[0];
+
+#if defined(__SSE2__)
+    if(count >= 4) {
+        __m128 vmax = _mm_loadu_ps(levels);
+
+        for(i = 4; i + 4 <= count; i += 4)
+            vmax = _mm_max_ps(vmax, _mm_loadu_ps(levels + i));
+        vmax = _mm_max_ps(vmax, _mm_movehl_ps(vmax, vmax));
+        vmax = _mm_max_ss(vmax, _mm_shuffle_ps(vmax, vmax, 1));
+        max = _mm_cvtss_f32(vmax);
+    }
+#endif
+
+    for(; i < count; ++i) {
+        if(levels[i] > max)
+            max = levels[i];
+    }
+    return max;
+}
+
+/*
+ * Fills one value per row of the layout from a levels array.
+ */
+void spectrum_bin(const spectrum_layout *layout, const float *levels, float *rows)
+{
+    const unsigned int *start = layout->start, *length = layout->length;
+    const float *weight = layout->weight;
+    const float *src;
+    unsigned int i;
+
+    for(i = 0; i < layout->rows; ++i) {
+        src = levels + start[i];
+        if(length[i])
+            rows[i] = spectrum_max(src, length[i]);
+        else
+            rows[i] = src[0] + weight[i] * (src[1] - src[0]);
+    }
+}
+
+/*
+ * history[i] = max(rows[i], history[i] - decay): peaks are taken at once
+ * and fall back by decay per call.
+ */
+void spectrum_peak(float *history, const float *rows, unsigned int count, float decay)
+{
+    unsigned int i = 0;
+    float fallen;
+
+#if defined(__SSE2__)
+    const __m128 vdecay = _mm_set1_ps(decay);
+
+    for(; i + 4 <= count; i += 4)
+        _mm_storeu_ps(history + i, _mm_max_ps(_mm_loadu_ps(rows + i), _mm_sub_ps(_mm_loadu_ps(history + i), vdecay)));
+#endif
+
+    for(; i < count; ++i) {
+        fallen = history[i] - decay;
+        history[i] = rows[i] > fallen ? rows[i] : fallen;
+    }
+}
+
+/*
+ * output[x * output_stride + y] = input[y * input_stride + x] for the width
+ * by height bytes of input.  The image is walked in tiles of
+ * TRANSPOSE_TILE bytes square, so reads and writes both stay within a few
+ * cache lines, and within a tile in blocks of 8 by 8 bytes.
+ */
+#define TRANSPOSE_TILE 64
+
+static inline void transpose_block(const unsigned char *input, unsigned int input_stride, unsigned char *output,
+                                   unsigned int output_stride, unsigned int width, unsigned int height)
+{
+    unsigned int x, y;
+
+#if defined(__SSE2__)
+    if(width == 8 && height == 8) {
+        /* interleave bytes, then pairs, then quads of neighbouring lines */
+        const __m128i t0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) input),
+                                             _mm_loadl_epi64((const __m128i *) (input + input_stride)));
+        const __m128i t1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (input + 2 * input_stride)),
+                                             _mm_loadl_epi64((const __m128i *) (input + 3 * input_stride)));
+        const __m128i t2 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (input + 4 * input_stride)),
+                                             _mm_loadl_epi64((const __m128i *) (input + 5 * input_stride)));
+        const __m128i t3 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (input + 6 * input_stride)),
+                                             _mm_loadl_epi64((const __m128i *) (input + 7 * input_stride)));
+        const __m128i u0 = _mm_unpacklo_epi16(t0, t1), u1 = _mm_unpackhi_epi16(t0, t1);
+        const __m128i u2 = _mm_unpacklo_epi16(t2, t3), u3 = _mm_unpackhi_epi16(t2, t3);
+        const __m128i v[4] = { _mm_unpacklo_epi32(u0, u2), _mm_unpackhi_epi32(u0, u2),
+                               _mm_unpacklo_epi32(u1, u3), _mm_unpackhi_epi32(u1, u3) };
+
+        for(x = 0; x < 4; ++x) {
+            _mm_storel_epi64((__m128i *) (output + 2 * x * output_stride), v[x]);
+            _mm_storel_epi64((__m128i *) (output + (2 * x + 1) * output_stride), _mm_srli_si128(v[x], 8));
+        }
+        return;
+    }
+#endif
+
+    for(x = 0; x < width; ++x)
+        for(y = 0; y < height; ++y)
+            output[x * output_stride + y] = input[y * input_stride + x];
+}
+
+void spectrum_transpose(const unsigned char *input, unsigned int input_stride, unsigned char *output,
+                        unsigned int output_stride, unsigned int width, unsigned int height)
+{
+    unsigned int tx, ty, x, y, w, h;
+
+    for(ty = 0; ty < height; ty += TRANSPOSE_TILE) {
+        for(tx = 0; tx < width; tx += TRANSPOSE_TILE) {
+            for(y = ty; y < height && y < ty + TRANSPOSE_TILE; y += 8) {
+                h = height - y < 8 ? height - y : 8;
+                for(x = tx; x < width && x < tx + TRANSPOSE_TILE; x += 8) {
+                    w = width - x < 8 ? width - x : 8;
+                    transpose_block(input + y * input_stride + x, input_stride,
+                                    output + x * output_stride + y, output_stride, w, h);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * output[t] = 0.5 * input[2t + c] + sum of taps[m] * (input[2t + c - n] +
+ * input[2t + c + n]), n = 2m + 1 for m < half and c = 2 * half - 1.
+ * input holds 2 * count + 4 * half - 2 samples.
+ */
+void spectrum_decimate(const float *input, float *output, unsigned int count, const float *taps, unsigned int half)
+{
+    const unsigned int centre = 2 * half - 1;
+    unsigned int t = 0, m;
+    float sum;
+
+#if defined(__SSE2__)
+    const __m128 middle = _mm_set1_ps(0.5f);
+
+    /* four outputs at a time, every second sample gathered by a shuffle */
+    for(; t + 4 <= count; t += 4) {
+        const float *x = input + 2 * t + centre;
+        __m128 even = _mm_shuffle_ps(_mm_loadu_ps(x), _mm_loadu_ps(x + 4), _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 acc = _mm_mul_ps(middle, even);
+
+        for(m = 0; m < half; ++m) {
+            const unsigned int n = 2 * m + 1;
+            const __m128 before = _mm_shuffle_ps(_mm_loadu_ps(x - n), _mm_loadu_ps(x - n + 4), _MM_SHUFFLE(2, 0, 2, 0));
+            const __m128 after = _mm_shuffle_ps(_mm_loadu_ps(x + n), _mm_loadu_ps(x + n + 4), _MM_SHUFFLE(2, 0, 2, 0));
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(taps[m]), _mm_add_ps(before, after)));
+        }
+        _mm_storeu_ps(output + t, acc);
+    }
+#endif
+
+    for(; t < count; ++t) {
+        const float *x = input + 2 * t + centre;
+        sum = 0.5f * x[0];
+        for(m = 0; m < half; ++m)
+            sum += taps[m] * (x[-(int) (2 * m + 1)] + x[2 * m + 1]);
+        output[t] = sum;
+    }
+}
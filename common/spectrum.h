@@ -0,0 +1,65 @@
+/* spectrum.h: Conversion of power spectra into display levels
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _SPECTRUM_H_
+#define _SPECTRUM_H_
+
+/*
+ * Largest absolute error of spectrum_log2 for normal inputs, in octaves.
+ * In decibels of power this is SPECTRUM_LOG2_ERROR * 3.0103, about 3.1e-4 dB.
+ */
+#define SPECTRUM_LOG2_ERROR 1.1e-4f
+
+/* Part of the power below the rolloff bin of spectrum_features */
+#define SPECTRUM_ROLLOFF 0.85f
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    float spectrum_log2(float x);
+    void spectrum_levels(const float *power, float *levels, unsigned int count, float scale, float offset);
+
+/* Features of a power spectrum, taken along with its levels */
+    typedef struct {
+        float centroid;     /* power weighted mean bin */
+        float rolloff;      /* bin below which SPECTRUM_ROLLOFF of the power lies */
+        float flatness;     /* geometric over arithmetic mean power, 0 to 1 */
+        float flux;         /* mean rise of log2 power since the last call */
+    } spectrum_features;
+    void spectrum_levels_features(const float *power, float *levels, unsigned int count, float scale, float offset,
+                                  float *history, float *partial, spectrum_features *features);
+
+/* Binning of levels into display rows */
+    typedef struct _struct_spectrum_layout spectrum_layout;
+    spectrum_layout *spectrum_layout_create(const float *edges, unsigned int rows, unsigned int bins);
+    void spectrum_layout_destroy(spectrum_layout *layout);
+    unsigned int spectrum_layout_rows(const spectrum_layout *layout);
+    void spectrum_bin(const spectrum_layout *layout, const float *levels, float *rows);
+    void spectrum_peak(float *history, const float *rows, unsigned int count, float decay);
+
+/* Transpose of byte images */
+    void spectrum_transpose(const unsigned char *input, unsigned int input_stride, unsigned char *output,
+                            unsigned int output_stride, unsigned int width, unsigned int height);
+
+/* Halving of the sample rate */
+    void spectrum_decimate(const float *input, float *output, unsigned int count, const float *taps, unsigned int half);
+
+#ifdef __cplusplus
+}
+#endif
+#endif  /* _SPECTRUM_H_ */
@@ -0,0 +1,743 @@
+#include "visualanalyzer.h"
+#include "voice.h"
+#include "inlines.h"
+#include "visualwisdom.h"
+#include "visualconstantq.h"
+#include "visualreassignment.h"
+#include "visualfeatures.h"
+
+#include <cmath>
+#include <cstring>
+#include <qmmp/soundcore.h>
+
+// levels span DB_FLOOR dBFS up over DB_RANGE dB and are kept in steps of
+// DB_STEP dB, each range step draws one step less of them
+#define DB_FLOOR    -48.2f
+#define DB_RANGE    65.5f
+#define DB_STEP     0.2569f
+// dB the history falls per node and unit of analyzer size
+#define DB_FALL     2.569f
+// octaves of frame size over which neighbouring resolutions are crossfaded
+#define MULTI_CROSSFADE 1.0f
+// ms between looks at the visual buffer, about a node at 44.1 kHz
+#define ANALYZER_INTERVAL 10
+// nodes taken from the visual buffer at each look, only the newest
+// ANALYZER_BACKLOG of them are analysed
+#define ANALYZER_TAKE   (4 * ANALYZER_BACKLOG)
+
+// largest first, so low rows get the finest frequency resolution
+static const int MULTI_RESOLUTION_SIZES[] = {4096, 1024, 256};
+// spectra kept per resolution, one for each frame of a batch and the last
+#define MULTI_SLOTS     (VisualAnalyzer::ANALYZER_BATCH + 1)
+
+static inline float *multiSlot(float *power, int resolution, int slot)
+{
+    return power + slot * (MULTI_RESOLUTION_SIZES[resolution] / 2 + 1);
+}
+
+VisualAnalyzer::VisualAnalyzer(Voice *voice)
+    : QThread(voice),
+      m_voice(voice),
+      m_changed(false),
+      m_stopped(false),
+      m_cost(0),
+      m_frequency(0),
+      m_columnStart(0),
+      m_written(0),
+      m_read(0)
+{
+    m_stft = new VisualSTFT(FFT_BUFFER_SIZE);
+    m_stft->reserve(ANALYZER_BACKLOG * QMMP_VISUAL_NODE_SIZE);
+    m_constantQ = new VisualConstantQ;
+
+    QList<int> sizes;
+    for(int i = 0; i < MULTI_RESOLUTIONS; ++i)
+    {
+        sizes << MULTI_RESOLUTION_SIZES[i];
+        m_multiPower[0][i] = new float[MULTI_SLOTS * (MULTI_RESOLUTION_SIZES[i] / 2 + 1)]{0};
+        m_multiPower[1][i] = new float[MULTI_SLOTS * (MULTI_RESOLUTION_SIZES[i] / 2 + 1)]{0};
+    }
+    m_multiResolution = new VisualSTFT(sizes);
+    m_multiResolution->reserve(ANALYZER_BACKLOG * QMMP_VISUAL_NODE_SIZE);
+
+    // bins under the floor would not show in any row
+    const float full = 32767.0f * FFT_BUFFER_SIZE / 2;
+    m_reassignment = new VisualReassignment(FFT_BUFFER_SIZE);
+    m_reassignment->setThreshold(full * full * std::pow(10.0f, DB_FLOOR / 10));
+    m_features = new VisualFeatures;
+    m_clock.start();
+}
+
+float VisualAnalyzer::rangeDecibels(int steps)
+{
+    return steps * DB_STEP;
+}
+
+VisualAnalyzer::~VisualAnalyzer()
+{
+    stop();
+
+    delete m_stft;
+    delete m_constantQ;
+    delete m_multiResolution;
+    delete m_reassignment;
+    delete m_features;
+    delete[] m_columns;
+    delete[] m_visualData;
+    delete[] m_rowData;
+    delete[] m_multiRows;
+    delete[] m_multiWeights;
+    spectrum_layout_destroy(m_layout);
+    spectrum_layout_destroy(m_constantQLayout);
+
+    for(int i = 0; i < MULTI_RESOLUTIONS; ++i)
+    {
+        delete[] m_multiPower[0][i];
+        delete[] m_multiPower[1][i];
+        spectrum_layout_destroy(m_multiLayouts[i]);
+    }
+}
+
+void VisualAnalyzer::setSettings(const Settings &settings)
+{
+    if(settings.rows != m_requested.rows || settings.twoChannels != m_requested.twoChannels)
+    {
+        ++m_geometry;
+    }
+    m_requested = settings;
+    setSampleRate(SoundCore::instance()->frequency());
+
+    QMutexLocker locker(&m_pendingMutex);
+    if(isRunning())
+    {
+        m_pending = settings;
+        m_pendingGeometry = m_geometry;
+        m_changed.store(true, std::memory_order_release);
+    }
+    else
+    {
+        // nothing older is left for the thread to take when it starts
+        m_changed.store(false, std::memory_order_relaxed);
+        applySettings(settings, m_geometry);
+    }
+}
+
+void VisualAnalyzer::takeSettings()
+{
+    if(!m_changed.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    Settings settings;
+    quint32 geometry;
+    {
+        QMutexLocker locker(&m_pendingMutex);
+        settings = m_pending;
+        geometry = m_pendingGeometry;
+        m_changed.store(false, std::memory_order_relaxed);
+    }
+    applySettings(settings, geometry);
+}
+
+void VisualAnalyzer::applySettings(const Settings &settings, quint32 geometry)
+{
+    const Settings previous = m_settings;
+    m_settings = settings;
+
+    if(previous.analysis != settings.analysis)
+    {
+        // the new analysis was not fed while the other one ran
+        m_overlayRow = -1;
+        clearAnalyses();
+    }
+
+    if(previous.size != settings.size)
+    {
+        // the linear analysis starts over with frames of the new size
+        delete m_stft;
+        m_stft = new VisualSTFT(qBound(2, settings.size, int(LINEAR_SIZE_MAX)));
+        m_stft->reserve(ANALYZER_BACKLOG * QMMP_VISUAL_NODE_SIZE);
+        m_features->clear();
+    }
+
+    m_stft->setWindow(settings.window);
+    m_stft->setHopSize(settings.hop);
+    m_constantQ->setHopSize(settings.hop);
+    m_multiResolution->setWindow(m_stft->window());
+    m_multiResolution->setHopSize(settings.hop);
+    m_reassignment->setWindow(m_stft->window());
+    m_reassignment->setHopSize(settings.hop);
+    m_settings.size = m_stft->size();
+
+    // each analysis bounds the hop to its frames, the settings keep the
+    // one asked for so that it comes back with larger frames
+    switch(settings.analysis)
+    {
+    case ANALYSIS_CONSTANT_Q: m_hop = m_constantQ->hopSize(); break;
+    case ANALYSIS_MULTI_RESOLUTION: m_hop = m_multiResolution->hopSize(); break;
+    case ANALYSIS_REASSIGNED: m_hop = m_reassignment->hopSize(); break;
+    default: m_hop = m_stft->hopSize(); break;
+    }
+
+    if(previous.rows != settings.rows || previous.size != settings.size)
+    {
+        createLayouts();
+    }
+
+    if(geometry != m_columnGeometry)
+    {
+        // the GUI thread asked for this geometry before it was handed
+        // over, and reads no column until it is published, so the old
+        // columns are dropped and their buffer is free to go
+        if(columnHeight() > m_columnCapacity || !m_columns)
+        {
+            m_columnCapacity = qMax(columnHeight(), 2 * m_columnCapacity);
+            delete[] m_columns;
+            m_columns = new uchar[COLUMN_QUEUE * m_columnCapacity];
+        }
+        m_finished = 0;
+        m_columnGeometry = geometry;
+        m_start = m_written.load(std::memory_order_relaxed);
+        m_columnStart.store(quint64(geometry) << 32 | m_start, std::memory_order_release);
+    }
+}
+
+void VisualAnalyzer::stop()
+{
+    m_stopped.store(true, std::memory_order_release);
+    wait();
+    m_stopped.store(false, std::memory_order_relaxed);
+}
+
+bool VisualAnalyzer::takeColumn(uchar *column, qint64 now)
+{
+    // none is taken until the thread has the rows and channels asked for,
+    // those of an older geometry are skipped
+    const quint64 start = m_columnStart.load(std::memory_order_acquire);
+    if(quint32(start >> 32) != m_geometry)
+    {
+        return false;
+    }
+
+    quint32 read = m_read.load(std::memory_order_relaxed);
+    if(qint32(quint32(start) - read) > 0)
+    {
+        read = quint32(start);
+        m_read.store(read, std::memory_order_release);
+    }
+
+    if(read == m_written.load(std::memory_order_acquire) || m_due[read % COLUMN_QUEUE] > now)
+    {
+        return false;
+    }
+
+    const int h = height();
+    memcpy(column, m_columns + (read % COLUMN_QUEUE) * h, h);
+    m_read.store(read + 1, std::memory_order_release);
+    return true;
+}
+
+void VisualAnalyzer::run()
+{
+    // the kernels are tuned here rather than on the GUI thread, for the
+    // transforms every analysis runs at its sizes; settings are handed
+    // over while it lasts, so the GUI thread only waits for it on a stop
+    QMap<int, int> transforms;
+    for(int size = FFT_SIZE_MIN; size <= LINEAR_SIZE_MAX; size <<= 1)
+    {
+        transforms[size] |= VisualWisdom::TRANSFORM_REAL | VisualWisdom::TRANSFORM_STEREO;
+    }
+    for(const int size : MULTI_RESOLUTION_SIZES)
+    {
+        transforms[size] |= VisualWisdom::TRANSFORM_REAL | VisualWisdom::TRANSFORM_STEREO;
+    }
+    transforms[VisualConstantQ::CONSTANTQ_FRAME] |= VisualWisdom::TRANSFORM_STEREO_COMPLEX;
+    transforms[m_reassignment->size()] |= VisualWisdom::TRANSFORM_COMPLEX_BATCH;
+    if(!VisualWisdom::initialize(transforms, m_stopped))
+    {
+        // stopped while tuning, the rest is tuned on the next start
+        return;
+    }
+
+    while(!m_stopped.load(std::memory_order_acquire))
+    {
+        takeSettings();
+
+        // take every node that is due, keeping the newest in a ring
+        int taken = 0;
+        while(taken < ANALYZER_TAKE && m_voice->takeData(m_nodes[taken % ANALYZER_BACKLOG][0], m_nodes[taken % ANALYZER_BACKLOG][1]))
+        {
+            ++taken;
+        }
+
+        // the newest sample taken is the one heard now, without the latency
+        // the output does not report
+        const qint64 now = clock() + m_settings.latency;
+        QElapsedTimer cost;
+        cost.start();
+        const int frequency = m_frequency.load(std::memory_order_relaxed);
+        m_sampleRate = frequency > 0 ? frequency : m_sampleRate;
+
+        if(m_settings.rows > 0)
+        {
+            const int first = qMax(0, taken - ANALYZER_BACKLOG);
+            if(first > 0)
+            {
+                skipNodes(first, now, (taken - first) * QMMP_VISUAL_NODE_SIZE);
+            }
+
+            analyse(first, taken, now);
+        }
+        m_cost.fetch_add(cost.nsecsElapsed(), std::memory_order_relaxed);
+
+        msleep(ANALYZER_INTERVAL);
+    }
+}
+
+void VisualAnalyzer::skipNodes(int nodes, qint64 time, int lag)
+{
+    // the analyses start over after the gap, while the last column is held
+    // for as long as the skipped audio lasts
+    clearAnalyses();
+
+    const quint32 written = m_written.load(std::memory_order_relaxed);
+    if(written == 0)
+    {
+        return;
+    }
+
+    const int h = columnHeight();
+    const uchar *last = m_columns + ((written - 1) % COLUMN_QUEUE) * h;
+    const int columns = qMin(nodes * QMMP_VISUAL_NODE_SIZE / m_hop, COLUMN_QUEUE - 1);
+    for(int i = 0; i < columns; ++i)
+    {
+        uchar *column = nextColumn();
+        if(!column)
+        {
+            break;
+        }
+
+        memcpy(column, last, h);
+        ++m_finished;
+    }
+    publishColumns(time, lag);
+}
+
+void VisualAnalyzer::clearAnalyses()
+{
+    m_stft->clear();
+    m_constantQ->clear();
+    m_multiResolution->clear();
+    m_reassignment->clear();
+    m_features->clear();
+}
+
+int VisualAnalyzer::delay() const
+{
+    switch(m_settings.analysis)
+    {
+    case ANALYSIS_CONSTANT_Q: return m_constantQ->delay();
+    case ANALYSIS_MULTI_RESOLUTION: return m_multiResolution->delay();
+    case ANALYSIS_REASSIGNED: return m_reassignment->delay();
+    default: return m_stft->delay();
+    }
+}
+
+uchar *VisualAnalyzer::nextColumn()
+{
+    // columns before m_start are never taken, their room is free
+    const quint32 next = m_written.load(std::memory_order_relaxed) + m_finished;
+    const quint32 read = m_read.load(std::memory_order_acquire);
+    if(next - (qint32(m_start - read) > 0 ? m_start : read) >= COLUMN_QUEUE)
+    {
+        // the GUI thread fell behind, the column is dropped
+        return nullptr;
+    }
+    return m_columns + (next % COLUMN_QUEUE) * columnHeight();
+}
+
+void VisualAnalyzer::publishColumns(qint64 time, int lag)
+{
+    // the columns finished are a hop apart, the newest lag samples before
+    // the one heard at time
+    const quint32 written = m_written.load(std::memory_order_relaxed);
+    for(int i = 0; i < m_finished; ++i)
+    {
+        const qint64 samples = lag + qint64(m_finished - 1 - i) * m_hop;
+        m_due[(written + i) % COLUMN_QUEUE] = time - samples * 1000 / m_sampleRate;
+    }
+
+    m_written.store(written + m_finished, std::memory_order_release);
+    m_finished = 0;
+}
+
+void VisualAnalyzer::analyse(int first, int taken, qint64 now)
+{
+    if(m_settings.analysis == ANALYSIS_LINEAR || m_settings.analysis == ANALYSIS_MULTI_RESOLUTION)
+    {
+        // the frames of every node taken are gathered and transformed in
+        // batches, the columns are still a hop apart
+        VisualSTFT *stft = m_settings.analysis == ANALYSIS_LINEAR ? m_stft : m_multiResolution;
+        for(int i = first; i < taken; ++i)
+        {
+            stft->append(m_nodes[i % ANALYZER_BACKLOG][0], m_nodes[i % ANALYZER_BACKLOG][1], QMMP_VISUAL_NODE_SIZE);
+        }
+
+        if(m_settings.analysis == ANALYSIS_LINEAR)
+        {
+            analyseLinear();
+        }
+        else
+        {
+            analyseMultiResolution();
+        }
+        publishColumns(now, delay());
+        return;
+    }
+
+    for(int i = first; i < taken; ++i)
+    {
+        analyseNode(m_nodes[i % ANALYZER_BACKLOG][0], m_nodes[i % ANALYZER_BACKLOG][1]);
+        publishColumns(now, (taken - 1 - i) * QMMP_VISUAL_NODE_SIZE + delay());
+    }
+}
+
+void VisualAnalyzer::analyseLinear()
+{
+    float *left[ANALYZER_BATCH], *right[ANALYZER_BATCH];
+    int updated[ANALYZER_BATCH];
+    for(int k = 0; k < ANALYZER_BATCH; ++k)
+    {
+        left[k] = m_linearPower[0][k];
+        right[k] = m_linearPower[1][k];
+    }
+
+    m_features->setFormat(m_sampleRate, m_stft->size());
+    int frames;
+    while((frames = m_stft->next(left, m_settings.twoChannels ? right : nullptr, updated, ANALYZER_BATCH)) > 0)
+    {
+        for(int k = 0; k < frames; ++k)
+        {
+            process(left[k], right[k]);
+            finishColumn();
+        }
+    }
+}
+
+void VisualAnalyzer::analyseMultiResolution()
+{
+    float *left[ANALYZER_BATCH * MULTI_RESOLUTIONS], *right[ANALYZER_BATCH * MULTI_RESOLUTIONS];
+    int updated[ANALYZER_BATCH];
+    int frames;
+    do
+    {
+        // frame k of a batch goes to the k-th slot after the one kept, so
+        // the kept spectrum stays for the frames before an update
+        for(int k = 0; k < ANALYZER_BATCH; ++k)
+        {
+            for(int i = 0; i < MULTI_RESOLUTIONS; ++i)
+            {
+                const int slot = (m_multiSlot[i] + 1 + k) % MULTI_SLOTS;
+                left[k * MULTI_RESOLUTIONS + i] = multiSlot(m_multiPower[0][i], i, slot);
+                right[k * MULTI_RESOLUTIONS + i] = multiSlot(m_multiPower[1][i], i, slot);
+            }
+        }
+
+        int base[MULTI_RESOLUTIONS];
+        memcpy(base, m_multiSlot, sizeof(base));
+        frames = m_multiResolution->next(left, m_settings.twoChannels ? right : nullptr, updated, ANALYZER_BATCH);
+        for(int k = 0; k < frames; ++k)
+        {
+            for(int i = 0; i < MULTI_RESOLUTIONS; ++i)
+            {
+                if(updated[k] & (1 << i))
+                {
+                    m_multiSlot[i] = (base[i] + 1 + k) % MULTI_SLOTS;
+                }
+            }
+            processMultiResolution(updated[k]);
+            finishColumn();
+        }
+    }
+    while(frames > 0);
+}
+
+void VisualAnalyzer::analyseNode(const float *left, const float *right)
+{
+    const bool showTwoChannels = m_settings.twoChannels;
+    float *power = showTwoChannels ? m_powerRight : nullptr;
+
+    if(m_settings.analysis == ANALYSIS_CONSTANT_Q)
+    {
+        m_constantQ->setFormat(m_sampleRate, m_settings.rows);
+        m_constantQ->append(left, showTwoChannels ? right : nullptr, QMMP_VISUAL_NODE_SIZE);
+        while(m_constantQ->next(m_powerLeft, power))
+        {
+            process(m_powerLeft, m_powerRight);
+            finishColumn();
+        }
+    }
+    else
+    {
+        m_reassignment->append(left, right, QMMP_VISUAL_NODE_SIZE);
+        while(m_reassignment->next(m_powerLeft, power))
+        {
+            process(m_powerLeft, m_powerRight);
+            finishColumn();
+        }
+    }
+}
+
+void VisualAnalyzer::process(const float *left, const float *right)
+{
+    if(m_settings.analysis == ANALYSIS_REASSIGNED)
+    {
+        // reassigned energy is already gathered per row
+        calc_levels(m_rowData, left, m_rows, m_reassignment->size(), DB_FLOOR, DB_RANGE);
+        if(m_settings.twoChannels)
+        {
+            calc_levels(m_rowData + m_rows, right, m_rows, m_reassignment->size(), DB_FLOOR, DB_RANGE);
+        }
+        else
+        {
+            memset(m_rowData + m_rows, 0, m_rows * sizeof(float));
+        }
+
+        updateHistory();
+        return;
+    }
+
+    // linear spectra start with the constant term, which is not drawn
+    const spectrum_layout *layout = m_layout;
+    int size = m_stft->size(), bins = size / 2, first = 1;
+    if(m_settings.analysis == ANALYSIS_CONSTANT_Q)
+    {
+        size = FFT_BUFFER_SIZE;
+        bins = m_constantQ->bins();
+        first = 0;
+        if(!m_constantQLayout || spectrum_layout_rows(m_constantQLayout) != uint(m_rows) || m_constantQBins != bins)
+        {
+            createConstantQLayout();
+        }
+        layout = m_constantQLayout;
+    }
+
+    float levels[LINEAR_SIZE_MAX / 2];
+    m_overlayRow = -1;
+    if(m_settings.analysis == ANALYSIS_LINEAR)
+    {
+        // features follow the left channel, the centroid is placed like the
+        // layout's edges, which count bins from the first one drawn
+        m_features->process(left + first, levels, bins, first, DB_FLOOR, DB_RANGE);
+
+        VisualFeatures::Record record;
+        if(m_settings.overlay && m_features->latest(&record))
+        {
+            const float position = record.centroid * FFT_BUFFER_SIZE / m_features->sampleRate() - first;
+            if(position >= 1.0f)
+            {
+                m_overlayRow = qMin(int(m_rows * std::log(position) / std::log(255.0f)), m_rows - 2);
+            }
+        }
+    }
+    else
+    {
+        calc_levels(levels, left + first, bins, size, DB_FLOOR, DB_RANGE);
+    }
+    spectrum_bin(layout, levels, m_rowData);
+    if(m_settings.twoChannels)
+    {
+        calc_levels(levels, right + first, bins, size, DB_FLOOR, DB_RANGE);
+        spectrum_bin(layout, levels, m_rowData + m_rows);
+    }
+    else
+    {
+        memset(m_rowData + m_rows, 0, m_rows * sizeof(float));
+    }
+
+    updateHistory();
+}
+
+void VisualAnalyzer::processMultiResolution(int updated)
+{
+    if(m_multiStale)
+    {
+        // the rows of every resolution were dropped with the old layouts
+        updated = (1 << MULTI_RESOLUTIONS) - 1;
+        m_multiStale = false;
+    }
+
+    const bool showTwoChannels = m_settings.twoChannels;
+    const int channels = showTwoChannels ? 2 : 1;
+    float levels[MULTI_RESOLUTION_SIZES[0] / 2];
+
+    for(int i = 0; i < MULTI_RESOLUTIONS; ++i)
+    {
+        if(!(updated & (1 << i)))
+        {
+            continue;
+        }
+
+        const int size = MULTI_RESOLUTION_SIZES[i];
+        for(int channel = 0; channel < channels; ++channel)
+        {
+            calc_levels(levels, multiSlot(m_multiPower[channel][i], i, m_multiSlot[i]) + 1, size / 2, size, DB_FLOOR, DB_RANGE);
+            spectrum_bin(m_multiLayouts[i], levels, m_multiRows + (2 * i + channel) * m_rows);
+        }
+    }
+
+    for(int channel = 0; channel < channels; ++channel)
+    {
+        float *rows = m_rowData + channel * m_rows;
+        for(int j = 0; j < m_rows; ++j)
+        {
+            float value = 0.0f;
+            for(int i = 0; i < MULTI_RESOLUTIONS; ++i)
+            {
+                value += m_multiWeights[i * m_rows + j] * m_multiRows[(2 * i + channel) * m_rows + j];
+            }
+            rows[j] = value;
+        }
+    }
+
+    if(!showTwoChannels)
+    {
+        memset(m_rowData + m_rows, 0, m_rows * sizeof(float));
+    }
+
+    updateHistory();
+}
+
+void VisualAnalyzer::updateHistory()
+{
+    const float decay = m_analyzerSize * DB_FALL / DB_RANGE * m_hop / QMMP_VISUAL_NODE_SIZE;
+    spectrum_peak(m_visualData, m_rowData, 2 * m_rows, decay);
+}
+
+void VisualAnalyzer::finishColumn()
+{
+    uchar *column = nextColumn();
+    if(!column)
+    {
+        return;
+    }
+
+    // row i of the data goes to line m_rows - 1 - i, above the first row of
+    // each channel stays empty
+    const int channels = m_settings.twoChannels ? 2 : 1;
+    for(int channel = 0; channel < channels; ++channel)
+    {
+        const float *levels = m_visualData + channel * m_rows;
+        uchar *line = column + (channel + 1) * m_rows - 1;
+        for(int i = 0; i < m_rows - 1; ++i)
+        {
+            *line-- = qMin(int(levels[i] * LEVEL_STEPS + 0.5f), OVERLAY_INDEX - 1);
+        }
+        *line = 0;
+    }
+
+    if(m_overlayRow >= 0)
+    {
+        column[m_rows - 1 - m_overlayRow] = OVERLAY_INDEX;
+    }
+
+    ++m_finished;
+}
+
+void VisualAnalyzer::createLayouts()
+{
+    m_rows = m_settings.rows;
+    spectrum_layout_destroy(m_layout);
+
+    // the rows only ever grow, so a resize back and forth allocates nothing
+    if(m_rows > m_rowCapacity || !m_visualData)
+    {
+        m_rowCapacity = qMax(m_rows, 2 * m_rowCapacity);
+        delete[] m_visualData;
+        delete[] m_rowData;
+        delete[] m_multiRows;
+        delete[] m_multiWeights;
+        m_visualData = new float[2 * m_rowCapacity];
+        m_rowData = new float[2 * m_rowCapacity];
+        m_multiRows = new float[2 * MULTI_RESOLUTIONS * m_rowCapacity];
+        m_multiWeights = new float[MULTI_RESOLUTIONS * m_rowCapacity];
+    }
+    memset(m_visualData, 0, 2 * m_rows * sizeof(float));
+    memset(m_rowData, 0, 2 * m_rows * sizeof(float));
+
+    float *edges = new float[m_rows + 1];
+    for(int i = 0; i < m_rows + 1; ++i)
+    {
+        edges[i] = std::pow(255.0, float(i) / m_rows);
+    }
+    // edges count FFT_BUFFER_SIZE bins, as for the multi resolution layouts
+    const int size = m_stft->size();
+    float *scaled = new float[m_rows + 1];
+    for(int i = 0; i < m_rows + 1; ++i)
+    {
+        scaled[i] = (edges[i] + 1.0f) * size / FFT_BUFFER_SIZE - 1.0f;
+    }
+    m_layout = spectrum_layout_create(scaled, m_rows, size / 2);
+    delete[] scaled;
+
+    createMultiResolutionLayout(edges);
+    m_reassignment->setRows(m_rows, edges[0], edges[m_rows]);
+    delete[] edges;
+}
+
+void VisualAnalyzer::createConstantQLayout()
+{
+    // constant Q bins are already spaced logarithmically, about one per row
+    m_constantQBins = m_constantQ->bins();
+    spectrum_layout_destroy(m_constantQLayout);
+
+    float *edges = new float[m_rows + 1];
+    for(int i = 0; i < m_rows + 1; ++i)
+    {
+        edges[i] = float(i) * m_constantQBins / m_rows;
+    }
+    m_constantQLayout = spectrum_layout_create(edges, m_rows, m_constantQBins);
+    delete[] edges;
+}
+
+void VisualAnalyzer::createMultiResolutionLayout(const float *edges)
+{
+    memset(m_multiRows, 0, 2 * MULTI_RESOLUTIONS * m_rows * sizeof(float));
+    m_multiStale = true;
+
+    // edges count FFT_BUFFER_SIZE bins from the first one above the constant term
+    float *scaled = new float[m_rows + 1];
+    for(int i = 0; i < MULTI_RESOLUTIONS; ++i)
+    {
+        const float ratio = float(MULTI_RESOLUTION_SIZES[i]) / FFT_BUFFER_SIZE;
+        for(int j = 0; j < m_rows + 1; ++j)
+        {
+            scaled[j] = (edges[j] + 1.0f) * ratio - 1.0f;
+        }
+
+        spectrum_layout_destroy(m_multiLayouts[i]);
+        m_multiLayouts[i] = spectrum_layout_create(scaled, m_rows, MULTI_RESOLUTION_SIZES[i] / 2);
+    }
+    delete[] scaled;
+
+    // a row is best served by the shortest frame whose bins are still no
+    // wider than the row, so its ideal size is FFT_BUFFER_SIZE over its
+    // width in FFT_BUFFER_SIZE bins; resolutions are crossfaded around the
+    // midpoints of their sizes on a log scale
+    for(int j = 0; j < m_rows; ++j)
+    {
+        const float width = qMax(edges[j + 1] - edges[j], 1e-3f);
+        const float ideal = std::log2(FFT_BUFFER_SIZE / width);
+        float remaining = 1.0f;
+
+        for(int i = 0; i < MULTI_RESOLUTIONS - 1; ++i)
+        {
+            const float middle = 0.5f * (std::log2(float(MULTI_RESOLUTION_SIZES[i])) + std::log2(float(MULTI_RESOLUTION_SIZES[i + 1])));
+            const float share = qBound(0.0f, (ideal - middle) / MULTI_CROSSFADE + 0.5f, 1.0f);
+            m_multiWeights[i * m_rows + j] = remaining * share;
+            remaining *= 1.0f - share;
+        }
+        m_multiWeights[(MULTI_RESOLUTIONS - 1) * m_rows + j] = remaining;
+    }
+}
@@ -0,0 +1,221 @@
+/***************************************************************************
+ * This file is part of the TTK qmmp plugin project
+ * Copyright (C) 2015 - 2026 Greedysky Studio
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; If not, see <http://www.gnu.org/licenses/>.
+ ***************************************************************************/
+
+#ifndef VISUALANALYZER_H
+#define VISUALANALYZER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <atomic>
+#include <qmmp/visual.h>
+#include "visualstft.h"
+#include "spectrum.h"
+
+class Voice;
+class VisualConstantQ;
+class VisualReassignment;
+class VisualFeatures;
+
+/*!
+ * Spectrogram analysis on a thread of its own. Nodes are taken from the
+ * visual buffer, analysed and finished into columns of color indices,
+ * which are queued for the GUI thread in a ring with one writer and one
+ * reader that takes no lock. Each column is due when the centre of its
+ * frame is heard, the latency setting later than the visual buffer has it.
+ * Every node that is due is analysed, so columns follow the audio rather
+ * than the timer. After a stall only the newest ANALYZER_BACKLOG nodes are,
+ * the last column is held for the ones before them. The linear and multi
+ * resolution analyses transform the frames of all nodes taken together,
+ * in batches of up to ANALYZER_BATCH.
+ * @author Greedysky <greedysky@163.com>
+ */
+class VisualAnalyzer : public QThread
+{
+    Q_OBJECT
+public:
+    enum Analysis
+    {
+        ANALYSIS_LINEAR,
+        ANALYSIS_CONSTANT_Q,
+        ANALYSIS_MULTI_RESOLUTION,
+        ANALYSIS_REASSIGNED
+    };
+
+    enum
+    {
+        LEVEL_STEPS = 255,      // color indices of levels go up to LEVEL_STEPS - 1
+        OVERLAY_INDEX = 255,    // color index of the centroid overlay
+        COLUMN_QUEUE = 512,     // columns waiting to be heard or drawn
+        ANALYZER_BACKLOG = 8,   // nodes analysed at most after a stall
+        ANALYZER_BATCH = 16,    // frames transformed at once at most, the widest lanes
+        MULTI_RESOLUTIONS = 3,
+        LINEAR_SIZE_MAX = 2 * FFT_BUFFER_SIZE
+    };
+
+    struct Settings
+    {
+        Analysis analysis = ANALYSIS_LINEAR;
+        VisualSTFT::Window window = VisualSTFT::WINDOW_DEFAULT;
+        int hop = QMMP_VISUAL_NODE_SIZE;
+        int size = FFT_BUFFER_SIZE; // frame size of the linear analysis, a power of 2 up to LINEAR_SIZE_MAX
+        int rows = 0;
+        bool twoChannels = true;
+        bool overlay = false;
+        int latency = 0;        // ms of output latency not taken into account by the visual buffer
+    };
+
+    explicit VisualAnalyzer(Voice *voice);
+    virtual ~VisualAnalyzer();
+
+    /*!
+     * Applies new settings. A running thread is handed them and takes them
+     * at its next look, without being held. Queued columns are dropped when
+     * the rows or channels change, and no column is taken until the thread
+     * has the new ones; so is the state of every analysis when the analysis
+     * changes, or of the linear one when its size does.
+     */
+    void setSettings(const Settings &settings);
+    inline const Settings &settings() const { return m_requested; }
+    /*!
+     * Returns the bytes of a column, the lines of the left channel above
+     * those of the right one when both are shown.
+     */
+    inline int height() const { return (m_requested.twoChannels ? 2 : 1) * m_requested.rows; }
+    /*!
+     * Returns the features of the frames analysed so far, taken from the
+     * linear analysis of the left channel.
+     */
+    inline const VisualFeatures *features() const { return m_features; }
+
+    /*!
+     * Asks the thread to finish and waits for it.
+     */
+    void stop();
+    /*!
+     * Returns the time on the clock columns are due by, in ms.
+     */
+    inline qint64 clock() const { return m_clock.elapsed(); }
+    /*!
+     * Copies the oldest finished column into column if it is due by now.
+     * Returns false when there is none. Only to be called from one thread.
+     */
+    bool takeColumn(uchar *column, qint64 now);
+    /*!
+     * Returns the ns spent analysing since the last call.
+     */
+    inline qint64 takeCost() { return m_cost.exchange(0, std::memory_order_relaxed); }
+    /*!
+     * Sets the sample rate of the audio to come, 0 when unknown. Sampled
+     * on the GUI thread, the thread takes it at its next look.
+     */
+    inline void setSampleRate(int rate) { m_frequency.store(rate, std::memory_order_relaxed); }
+    /*!
+     * Returns the dB that steps of the range take off the top of the levels.
+     */
+    static float rangeDecibels(int steps);
+
+private:
+    virtual void run() override final;
+
+    void takeSettings();
+    void applySettings(const Settings &settings, quint32 geometry);
+    inline int columnHeight() const { return (m_settings.twoChannels ? 2 : 1) * m_settings.rows; }
+    void analyse(int first, int taken, qint64 now);
+    void analyseNode(const float *left, const float *right);
+    void analyseLinear();
+    void analyseMultiResolution();
+    void skipNodes(int nodes, qint64 time, int lag);
+    void clearAnalyses();
+    int delay() const;
+    uchar *nextColumn();
+    void publishColumns(qint64 time, int lag);
+    void process(const float *left, const float *right);
+    void processMultiResolution(int updated);
+    void updateHistory();
+    void finishColumn();
+    void createLayouts();
+    void createConstantQLayout();
+    void createMultiResolutionLayout(const float *edges);
+
+    Voice *m_voice;
+    // settings last asked for on the GUI thread, and how many times the
+    // rows or channels changed with them
+    Settings m_requested;
+    quint32 m_geometry = 0;
+    // settings handed over to the thread, while m_changed is set
+    QMutex m_pendingMutex;
+    Settings m_pending;
+    quint32 m_pendingGeometry = 0;
+    std::atomic<bool> m_changed;
+    // settings the thread runs with
+    Settings m_settings;
+    // samples between the columns of the analysis in use
+    int m_hop = QMMP_VISUAL_NODE_SIZE;
+    std::atomic<bool> m_stopped;
+    std::atomic<qint64> m_cost;
+    std::atomic<int> m_frequency;
+
+    // the column queue, m_written and m_read only ever grow; the next
+    // m_finished columns are written but not yet given a due time. Columns
+    // from m_start on have geometry m_columnGeometry, m_columnStart holds
+    // both for the GUI thread, which takes none of an older geometry
+    uchar *m_columns = nullptr;
+    int m_columnCapacity = 0;
+    quint32 m_columnGeometry = 0, m_start = 0;
+    std::atomic<quint64> m_columnStart;
+    qint64 m_due[COLUMN_QUEUE];
+    std::atomic<quint32> m_written, m_read;
+    int m_finished = 0;
+    QElapsedTimer m_clock;
+    int m_sampleRate = 44100;
+
+    // rows the layouts were made for, and the most the row buffers hold
+    int m_rows = 0, m_rowCapacity = 0;
+    spectrum_layout *m_layout = nullptr, *m_constantQLayout = nullptr;
+    const double m_analyzerSize = 2.2;
+    float *m_visualData = nullptr;
+    float *m_rowData = nullptr;
+    // the newest nodes taken, both channels of each
+    float m_nodes[ANALYZER_BACKLOG][2][QMMP_VISUAL_NODE_SIZE];
+    // power spectra, with room for the bins of either analysis
+    float m_powerLeft[LINEAR_SIZE_MAX];
+    float m_powerRight[LINEAR_SIZE_MAX];
+    // power spectra of the linear frames transformed in one batch
+    float m_linearPower[2][ANALYZER_BATCH][LINEAR_SIZE_MAX / 2 + 1];
+    int m_constantQBins = 0;
+    VisualSTFT *m_stft = nullptr;
+    VisualConstantQ *m_constantQ = nullptr;
+    // power spectra of each resolution and their rows, kept until it is due
+    // again; each resolution has a slot per frame of a batch and one for
+    // the spectrum kept, m_multiSlot[i]
+    VisualSTFT *m_multiResolution = nullptr;
+    float *m_multiPower[2][MULTI_RESOLUTIONS];
+    int m_multiSlot[MULTI_RESOLUTIONS] = {};
+    spectrum_layout *m_multiLayouts[MULTI_RESOLUTIONS] = {};
+    float *m_multiRows = nullptr;
+    float *m_multiWeights = nullptr;
+    bool m_multiStale = false;
+    VisualReassignment *m_reassignment = nullptr;
+    VisualFeatures *m_features = nullptr;
+    // row of the newest centroid in the overlay, or -1
+    int m_overlayRow = -1;
+
+};
+
+#endif
@@ -0,0 +1,402 @@
+#include "visualconstantq.h"
+#include "spectrum.h"
+
+#include <cmath>
+#include <cstring>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846	/* pi */
+#endif
+// the octaves reach down to about this frequency in Hz
+#define LOWEST_FREQUENCY 30.0
+// upper end of the highest octave, relative to the sample rate
+#define TOP_RATIO 0.4
+// kernel entries below this part of their bin's largest one are dropped
+#define SPARSE_THRESHOLD 0.005
+// an octave is transformed again once it has this many new samples, or a
+// hop when that is less
+#define MIN_ADVANCE (CONSTANTQ_FRAME * 3 / 4)
+#define MAX_KERNELS 8
+// halfband decimation filter with HALFBAND_HALF odd taps a side, Kaiser
+// windowed for about 60 dB of stopband
+#define HALFBAND_HALF 10
+#define HALFBAND_TAPS (4 * HALFBAND_HALF - 1)
+#define HALFBAND_BETA 5.65
+// decimated sample j is centred on sample 2j - HALFBAND_DELAY of the octave
+// above it
+#define HALFBAND_DELAY (2 * HALFBAND_HALF - 2)
+
+// zeroth order modified Bessel function of the first kind
+static double besselI0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for(int k = 1; k < 32; ++k)
+    {
+        const double f = x / (2.0 * k);
+        term *= f * f;
+        sum += term;
+        if(term < sum * 1e-12)
+        {
+            break;
+        }
+    }
+    return sum;
+}
+
+// one side's odd taps of the halfband filter, see spectrum_decimate
+struct Halfband
+{
+    Halfband()
+    {
+        double sum = 0.0;
+        for(int m = 0; m < HALFBAND_HALF; ++m)
+        {
+            // windowed sinc with its cutoff at a quarter of the rate
+            const int n = 2 * m + 1;
+            const double r = double(n) / (2 * HALFBAND_HALF - 1);
+            const double w = besselI0(HALFBAND_BETA * std::sqrt(1.0 - r * r)) / besselI0(HALFBAND_BETA);
+            taps[m] = std::sin(M_PI * n / 2) / (M_PI * n) * w;
+            sum += taps[m];
+        }
+
+        // unity gain at DC
+        for(int m = 0; m < HALFBAND_HALF; ++m)
+        {
+            taps[m] *= 0.25 / sum;
+        }
+    }
+
+    float taps[HALFBAND_HALF];
+};
+static const Halfband halfband;
+
+// input samples the lowest of octaves lags the top one by
+static int lowestLag(int octaves)
+{
+    return HALFBAND_DELAY * ((1 << (octaves - 1)) - 1);
+}
+
+
+VisualConstantQ::VisualConstantQ()
+{
+    // every ring holds a frame and an appended block on top of what the
+    // lowest octave lags it by, at its own rate
+    m_octaves = new Octave[CONSTANTQ_MAX_OCTAVES];
+    int size = 0;
+    for(int o = 0; o < CONSTANTQ_MAX_OCTAVES; ++o)
+    {
+        m_octaves[o].capacity = CONSTANTQ_RING + (lowestLag(CONSTANTQ_MAX_OCTAVES) >> o);
+        size += 4 * m_octaves[o].capacity;
+    }
+
+    m_rings = new float[size];
+    float *ring = m_rings;
+    for(int o = 0; o < CONSTANTQ_MAX_OCTAVES; ++o)
+    {
+        m_octaves[o].left = ring;
+        m_octaves[o].right = ring + 2 * m_octaves[o].capacity;
+        ring += 4 * m_octaves[o].capacity;
+    }
+    m_state = fft_init_size(CONSTANTQ_FRAME);
+    m_stereoState = fft_init_size(CONSTANTQ_FRAME);
+    clear();
+}
+
+VisualConstantQ::~VisualConstantQ()
+{
+    fft_close(m_state);
+    fft_close(m_stereoState);
+    qDeleteAll(m_kernels);
+    delete[] m_octaves;
+    delete[] m_rings;
+}
+
+bool VisualConstantQ::setFormat(int sampleRate, int rows)
+{
+    if(sampleRate <= 0)
+    {
+        sampleRate = 44100;
+    }
+
+    if(m_kernel && m_kernel->sampleRate == sampleRate && m_kernel->rows == rows)
+    {
+        return false;
+    }
+
+    const quint64 key = (quint64(sampleRate) << 32) | quint32(rows);
+    Kernel *kernel = m_kernels.value(key);
+    if(!kernel)
+    {
+        if(m_kernels.count() >= MAX_KERNELS)
+        {
+            qDeleteAll(m_kernels);
+            m_kernels.clear();
+        }
+
+        kernel = createKernel(sampleRate, rows);
+        m_kernels.insert(key, kernel);
+    }
+
+    // the rings of octaves that were not fed are behind the others
+    const int octaves = m_kernel ? m_kernel->octaves : 1;
+    m_kernel = kernel;
+    if(kernel->octaves != octaves)
+    {
+        clear();
+        return true;
+    }
+
+    memset(m_powerLeft, 0, sizeof(m_powerLeft));
+    memset(m_powerRight, 0, sizeof(m_powerRight));
+    for(int i = 0; i < CONSTANTQ_MAX_OCTAVES; ++i)
+    {
+        m_octaves[i].computed = 0;
+    }
+    return true;
+}
+
+void VisualConstantQ::setHopSize(int hop)
+{
+    m_hop = qBound(1, hop, int(CONSTANTQ_RING - CONSTANTQ_FRAME));
+}
+
+void VisualConstantQ::clear()
+{
+    m_written = 0;
+    m_next = 0;
+    for(int o = 0; o < CONSTANTQ_MAX_OCTAVES; ++o)
+    {
+        Octave &octave = m_octaves[o];
+        octave.written = octave.computed = 0;
+        memset(octave.left, 0, 4 * octave.capacity * sizeof(float));
+    }
+    memset(m_powerLeft, 0, sizeof(m_powerLeft));
+    memset(m_powerRight, 0, sizeof(m_powerRight));
+}
+
+void VisualConstantQ::append(const float *left, const float *right, int samples)
+{
+    // blocks small enough that no window still to be read gets overwritten
+    const int block = (CONSTANTQ_RING - HALFBAND_TAPS) & ~1;
+    for(int done = 0; done < samples; done += block)
+    {
+        appendBlock(left + done, right ? right + done : nullptr, qMin(block, samples - done));
+    }
+
+    m_written += samples;
+    const int lag = m_kernel ? m_kernel->lookahead : 0;
+    if(m_written - m_next > quint64(CONSTANTQ_RING - CONSTANTQ_FRAME + lag))
+    {
+        m_next = m_written - CONSTANTQ_FRAME - lag;
+    }
+}
+
+bool VisualConstantQ::next(float *left, float *right)
+{
+    if(!m_kernel || !m_state || !m_stereoState)
+    {
+        return false;
+    }
+
+    // every octave's frame ends where the top one's does, later by the
+    // decimation filters' delay in its samples; the column waits until the
+    // lowest octave has its frame
+    const int octaves = m_kernel->octaves;
+    quint64 ends[CONSTANTQ_MAX_OCTAVES];
+    quint64 end = m_next + CONSTANTQ_FRAME;
+    for(int o = 0; o < octaves; ++o)
+    {
+        if(end > m_octaves[o].written)
+        {
+            return false;
+        }
+        ends[o] = end;
+        end = (end + HALFBAND_DELAY) / 2;
+    }
+    m_next += m_hop;
+
+    // lower octaves move slower, they are only transformed again when
+    // enough new samples came in
+    const int advance = qMin(m_hop, MIN_ADVANCE);
+    for(int o = 0; o < octaves; ++o)
+    {
+        Octave &octave = m_octaves[o];
+        const quint64 last = ends[o];
+        if(last < octave.computed + advance)
+        {
+            continue;
+        }
+
+        octave.computed = last;
+        const int start = int((last + octave.capacity - CONSTANTQ_FRAME) % octave.capacity);
+        transform(octave.left + start, right ? octave.right + start : nullptr, (octaves - 1 - o) * m_kernel->binsPerOctave);
+    }
+
+    memcpy(left, m_powerLeft, bins() * sizeof(float));
+    if(right)
+    {
+        memcpy(right, m_powerRight, bins() * sizeof(float));
+    }
+    return true;
+}
+
+void VisualConstantQ::write(float *ring, int capacity, quint64 position, const float *samples, int count)
+{
+    // into both halves of the mirrored ring, wrapping at its end
+    const int index = int(position % capacity);
+    const int head = qMin(count, capacity - index);
+    memcpy(ring + index, samples, head * sizeof(float));
+    memcpy(ring, samples + head, (count - head) * sizeof(float));
+    memcpy(ring + index + capacity, samples, head * sizeof(float));
+    if(count > head)
+    {
+        memcpy(ring + capacity, samples + head, (count - head) * sizeof(float));
+    }
+}
+
+void VisualConstantQ::appendBlock(const float *left, const float *right, int samples)
+{
+    float bufferLeft[CONSTANTQ_RING / 2], bufferRight[CONSTANTQ_RING / 2];
+    const int octaves = m_kernel ? m_kernel->octaves : 1;
+
+    for(int o = 0; o < octaves && samples > 0; ++o)
+    {
+        Octave &octave = m_octaves[o];
+        const quint64 begin = octave.written;
+        write(octave.left, octave.capacity, begin, left, samples);
+        if(right)
+        {
+            write(octave.right, octave.capacity, begin, right, samples);
+        }
+        octave.written += samples;
+
+        // the next octave gets one sample for every even sample count, all
+        // their filter windows follow each other in the mirrored ring
+        const quint64 first = (begin + 2) & ~quint64(1);
+        if(o + 1 == octaves || first > octave.written)
+        {
+            break;
+        }
+
+        const int start = int((first + octave.capacity - HALFBAND_TAPS) % octave.capacity);
+        samples = int((octave.written - first) / 2 + 1);
+        spectrum_decimate(octave.left + start, bufferLeft, samples, halfband.taps, HALFBAND_HALF);
+        if(right)
+        {
+            spectrum_decimate(octave.right + start, bufferRight, samples, halfband.taps, HALFBAND_HALF);
+        }
+
+        left = bufferLeft;
+        right = right ? bufferRight : nullptr;
+    }
+}
+
+VisualConstantQ::Kernel *VisualConstantQ::createKernel(int sampleRate, int rows) const
+{
+    Kernel *kernel = new Kernel;
+    kernel->sampleRate = sampleRate;
+    kernel->rows = rows;
+    kernel->octaves = qBound(1, int(std::ceil(std::log2(TOP_RATIO * sampleRate / LOWEST_FREQUENCY))), int(CONSTANTQ_MAX_OCTAVES));
+    kernel->lookahead = lowestLag(kernel->octaves);
+    kernel->binsPerOctave = qBound(int(CONSTANTQ_MIN_BINS_PER_OCTAVE), (rows + kernel->octaves - 1) / kernel->octaves, int(CONSTANTQ_MAX_BINS_PER_OCTAVE));
+    kernel->offsets.append(0);
+
+    const int bins = kernel->binsPerOctave;
+    const double q = 1.0 / (std::pow(2.0, 1.0 / bins) - 1.0);
+    const int half = CONSTANTQ_FRAME / 2;
+
+    fft_state *state = fft_init_size(CONSTANTQ_FRAME);
+    float a[CONSTANTQ_FRAME], b[CONSTANTQ_FRAME];
+    float aReal[half + 1], aImag[half + 1], bReal[half + 1], bImag[half + 1];
+
+    for(int k = 0; k < bins; ++k)
+    {
+        // centre frequency in cycles per sample, the window spans q periods
+        const double f = TOP_RATIO * std::pow(2.0, double(k - bins) / bins);
+        const int length = qMin(int(CONSTANTQ_FRAME), int(std::ceil(q / f)));
+        const int offset = (CONSTANTQ_FRAME - length) / 2;
+
+        double sum = 0.0;
+        for(int n = 0; n < length; ++n)
+        {
+            sum += 0.5 - 0.5 * std::cos(2.0 * M_PI * n / length);
+        }
+
+        // temporal kernel t = a + ib, a full scale sine at f gives the same
+        // magnitude as in a FFT_BUFFER_SIZE point fft_perform
+        memset(a, 0, sizeof(a));
+        memset(b, 0, sizeof(b));
+        for(int n = 0; n < length; ++n)
+        {
+            const double w = (0.5 - 0.5 * std::cos(2.0 * M_PI * n / length)) * FFT_BUFFER_SIZE / sum;
+            a[offset + n] = w * std::cos(2.0 * M_PI * f * n);
+            b[offset + n] = -w * std::sin(2.0 * M_PI * f * n);
+        }
+
+        // spectral kernel T = A + iB, applied as conj(T) / size; the
+        // transform's 32767 input scale is taken out again
+        fft_perform_complex(a, aReal, aImag, state);
+        fft_perform_complex(b, bReal, bImag, state);
+
+        double largest = 0.0;
+        for(int j = 0; j <= half; ++j)
+        {
+            largest = qMax(largest, std::hypot(double(aReal[j] - bImag[j]), double(aImag[j] + bReal[j])));
+        }
+
+        const double scale = 1.0 / (CONSTANTQ_FRAME * 32767.0);
+        for(int j = 0; j <= half; ++j)
+        {
+            const double real = double(aReal[j]) - bImag[j], imag = double(aImag[j]) + bReal[j];
+            if(std::hypot(real, imag) >= SPARSE_THRESHOLD * largest)
+            {
+                kernel->index.append(j);
+                kernel->real.append(real * scale);
+                kernel->imag.append(-imag * scale);
+            }
+        }
+        kernel->offsets.append(kernel->index.count());
+    }
+
+    fft_close(state);
+    return kernel;
+}
+
+void VisualConstantQ::transform(const float *left, const float *right, int first)
+{
+    if(right)
+    {
+        float *outputs[] = { m_realLeft, m_imagLeft, m_realRight, m_imagRight };
+        fft_perform_stereo_complex(left, right, outputs, m_stereoState);
+        applyKernel(m_realRight, m_imagRight, m_powerRight + first);
+    }
+    else
+    {
+        fft_perform_complex(left, m_realLeft, m_imagLeft, m_state);
+    }
+    applyKernel(m_realLeft, m_imagLeft, m_powerLeft + first);
+}
+
+void VisualConstantQ::applyKernel(const float *spectrumReal, const float *spectrumImag, float *power) const
+{
+    const int *offsets = m_kernel->offsets.constData();
+    const int *index = m_kernel->index.constData();
+    const float *kernelReal = m_kernel->real.constData();
+    const float *kernelImag = m_kernel->imag.constData();
+
+    for(int k = 0; k < m_kernel->binsPerOctave; ++k)
+    {
+        float real = 0.0f, imag = 0.0f, realDiff = 0.0f, imagDiff = 0.0f;
+        for(int e = offsets[k]; e < offsets[k + 1]; ++e)
+        {
+            const int j = index[e];
+            real += spectrumReal[j] * kernelReal[e];
+            realDiff += spectrumImag[j] * kernelImag[e];
+            imag += spectrumReal[j] * kernelImag[e];
+            imagDiff += spectrumImag[j] * kernelReal[e];
+        }
+        real -= realDiff;
+        imag += imagDiff;
+        power[k] = real * real + imag * imag;
+    }
+}
@@ -0,0 +1,133 @@
+/***************************************************************************
+ * This file is part of the TTK qmmp plugin project
+ * Copyright (C) 2015 - 2026 Greedysky Studio
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; If not, see <http://www.gnu.org/licenses/>.
+ ***************************************************************************/
+
+#ifndef VISUALCONSTANTQ_H
+#define VISUALCONSTANTQ_H
+
+#include <QHash>
+#include <QVector>
+#include "fft.h"
+
+/*!
+ * Streaming constant Q transform after Brown and Puckette: every bin is the
+ * product of a short FFT with a sparse, precomputed spectral kernel. One
+ * kernel covers one octave of a CONSTANTQ_FRAME sample frame, lower octaves
+ * reuse it on the input decimated by two per octave.
+ * @author Greedysky <greedysky@163.com>
+ */
+class VisualConstantQ
+{
+public:
+    enum
+    {
+        CONSTANTQ_FRAME = 256,
+        CONSTANTQ_RING = 1024,
+        CONSTANTQ_MAX_OCTAVES = 11,
+        CONSTANTQ_MIN_BINS_PER_OCTAVE = 24,
+        CONSTANTQ_MAX_BINS_PER_OCTAVE = 32,
+        CONSTANTQ_MAX_BINS = CONSTANTQ_MAX_OCTAVES * CONSTANTQ_MAX_BINS_PER_OCTAVE
+    };
+
+    VisualConstantQ();
+    ~VisualConstantQ();
+
+    VisualConstantQ(const VisualConstantQ &) = delete;
+    VisualConstantQ &operator=(const VisualConstantQ &) = delete;
+
+    /*!
+     * Picks the kernel for a sample rate and the number of rows it is drawn
+     * on, with about one bin per row. Kernels are built once and cached.
+     * Returns true when the kernel changed.
+     */
+    bool setFormat(int sampleRate, int rows);
+    /*!
+     * Returns the number of bins, lowest frequency first.
+     */
+    inline int bins() const { return m_kernel ? m_kernel->octaves * m_kernel->binsPerOctave : 0; }
+
+    /*!
+     * Sets the distance between columns in input samples.
+     */
+    void setHopSize(int hop);
+    inline int hopSize() const { return m_hop; }
+
+    /*!
+     * Drops all buffered samples.
+     */
+    void clear();
+    /*!
+     * Appends samples of both channels, or only of the left one when right
+     * is null. When the caller falls behind, the oldest unanalysed columns
+     * are dropped.
+     */
+    void append(const float *left, const float *right, int samples);
+    /*!
+     * Computes the next due column into bins() power values scaled like
+     * those of a FFT_BUFFER_SIZE point fft_perform, both channels or only
+     * the left one when right is null. Returns false when no column is due.
+     */
+    bool next(float *left, float *right);
+    /*!
+     * Returns the samples appended since the centre of the newest column's
+     * frame at the full sample rate. Columns are held until the lowest
+     * octave has caught up with the decimation filters' delay.
+     */
+    inline int delay() const { return int(qint64(m_written) - qint64(m_next) + m_hop - CONSTANTQ_FRAME / 2); }
+
+private:
+    struct Kernel
+    {
+        int sampleRate, rows;
+        int octaves, binsPerOctave;
+        // input samples the lowest octave lags the top one by
+        int lookahead;
+        // entries of bin k are offsets[k] up to offsets[k + 1]
+        QVector<int> offsets, index;
+        QVector<float> real, imag;
+    };
+
+    struct Octave
+    {
+        // each ring holds its capacity of samples twice, so every frame is
+        // contiguous; lower octaves wait less for the lowest one, their
+        // rings are shorter
+        float *left, *right;
+        int capacity;
+        quint64 written, computed;
+    };
+
+    Kernel *createKernel(int sampleRate, int rows) const;
+    static void write(float *ring, int capacity, quint64 position, const float *samples, int count);
+    void appendBlock(const float *left, const float *right, int samples);
+    void transform(const float *left, const float *right, int first);
+    void applyKernel(const float *spectrumReal, const float *spectrumImag, float *power) const;
+
+    Kernel *m_kernel = nullptr;
+    QHash<quint64, Kernel*> m_kernels;
+    Octave *m_octaves;
+    float *m_rings;
+    int m_hop = 512;
+    quint64 m_written = 0, m_next = 0;
+    float m_powerLeft[CONSTANTQ_MAX_BINS], m_powerRight[CONSTANTQ_MAX_BINS];
+    float m_realLeft[CONSTANTQ_FRAME / 2 + 1], m_imagLeft[CONSTANTQ_FRAME / 2 + 1];
+    float m_realRight[CONSTANTQ_FRAME / 2 + 1], m_imagRight[CONSTANTQ_FRAME / 2 + 1];
+    fft_state *m_state = nullptr, *m_stereoState = nullptr;
+
+};
+
+#endif
@@ -0,0 +1,139 @@
+#include "visualfeatures.h"
+#include "spectrum.h"
+
+#include <cmath>
+#include <cstring>
+
+// weight of the newest frame in the running mean flux onsets are told from
+#define ONSET_SMOOTHING 0.1f
+
+VisualFeatures::VisualFeatures()
+    : m_written(0)
+{
+    for(Slot &slot : m_ring)
+    {
+        slot.sequence.store(0, std::memory_order_relaxed);
+        for(std::atomic<quint32> &word : slot.words)
+        {
+            word.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+VisualFeatures::~VisualFeatures()
+{
+    delete[] m_history;
+    delete[] m_partial;
+}
+
+void VisualFeatures::setFormat(int sampleRate, int size)
+{
+    if(sampleRate > 0)
+    {
+        m_sampleRate = sampleRate;
+    }
+    m_size = size;
+}
+
+void VisualFeatures::clear()
+{
+    m_continued = false;
+    m_fluxMean = 0.0f;
+}
+
+void VisualFeatures::process(const float *power, float *levels, int count, int first, float floor_db, float range_db)
+{
+    if(m_count != count)
+    {
+        delete[] m_history;
+        delete[] m_partial;
+        m_count = count;
+        m_history = new float[count]();
+        m_partial = new float[(count + 3) / 4];
+        m_continued = false;
+    }
+
+    // the same mapping as calc_levels
+    const float full_db = 20.0f * std::log10(32767.0f * m_size / 2);
+    const float scale = 10.0f * std::log10(2.0f) / range_db;
+    const float offset = -(full_db + floor_db) / range_db;
+
+    spectrum_features features;
+    spectrum_levels_features(power, levels, count, scale, offset, m_history, m_partial, &features);
+
+    // the first frame has nothing to rise from
+    const float binWidth = float(m_sampleRate) / m_size;
+    const float flux = m_continued ? features.flux * 10.0f * std::log10(2.0f) : 0.0f;
+    m_continued = true;
+    const float onset = qMax(0.0f, flux - m_fluxMean);
+    m_fluxMean += ONSET_SMOOTHING * (flux - m_fluxMean);
+
+    push({m_frames++, (features.centroid + first) * binWidth, (features.rolloff + first) * binWidth,
+          features.flatness, flux, onset});
+}
+
+bool VisualFeatures::latest(Record *record) const
+{
+    return history(record, 1) == 1;
+}
+
+int VisualFeatures::history(Record *records, int count) const
+{
+    const quint64 written = m_written.load(std::memory_order_acquire);
+    int copied = 0;
+
+    count = int(qMin<quint64>(qMin<quint64>(count, written), FEATURES_HISTORY));
+    for(quint64 index = written - count; index < written; ++index)
+    {
+        // records overwritten meanwhile are left out
+        if(read(index, records + copied))
+        {
+            ++copied;
+        }
+    }
+    return copied;
+}
+
+bool VisualFeatures::read(quint64 index, Record *record) const
+{
+    const Slot &slot = m_ring[index % FEATURES_HISTORY];
+    for(;;)
+    {
+        const quint32 before = slot.sequence.load(std::memory_order_acquire);
+        if(before & 1)
+        {
+            continue;
+        }
+
+        quint32 words[sizeof(Record) / sizeof(quint32)];
+        for(size_t i = 0; i < sizeof(Record) / sizeof(quint32); ++i)
+        {
+            words[i] = slot.words[i].load(std::memory_order_relaxed);
+        }
+        std::memcpy(record, words, sizeof(Record));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(slot.sequence.load(std::memory_order_relaxed) == before)
+        {
+            // the slot was written once per lap of the ring
+            return before == 2 * (index / FEATURES_HISTORY + 1);
+        }
+    }
+}
+
+void VisualFeatures::push(const Record &record)
+{
+    const quint64 index = m_written.load(std::memory_order_relaxed);
+    Slot &slot = m_ring[index % FEATURES_HISTORY];
+    const quint32 sequence = slot.sequence.load(std::memory_order_relaxed);
+
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    quint32 words[sizeof(Record) / sizeof(quint32)];
+    std::memcpy(words, &record, sizeof(Record));
+    for(size_t i = 0; i < sizeof(Record) / sizeof(quint32); ++i)
+    {
+        slot.words[i].store(words[i], std::memory_order_relaxed);
+    }
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    m_written.store(index + 1, std::memory_order_release);
+}
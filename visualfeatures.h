@@ -0,0 +1,103 @@
+/***************************************************************************
+ * This file is part of the TTK qmmp plugin project
+ * Copyright (C) 2015 - 2026 Greedysky Studio
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; If not, see <http://www.gnu.org/licenses/>.
+ ***************************************************************************/
+
+#ifndef VISUALFEATURES_H
+#define VISUALFEATURES_H
+
+#include <QtGlobal>
+#include <atomic>
+
+/*!
+ * Spectral features of every analysed frame, taken in the same pass that
+ * turns its power spectrum into levels. Records are kept in a ring that
+ * one thread writes and any thread reads without locking; a reader that
+ * raced the writer simply tries the record again.
+ * @author Greedysky <greedysky@163.com>
+ */
+class VisualFeatures
+{
+public:
+    struct Record
+    {
+        quint64 frame;      // frames processed before this one
+        float centroid;     // Hz
+        float rolloff;      // Hz
+        float flatness;     // 0 for a pure tone up to 1 for white noise
+        float flux;         // mean rise per bin since the last frame, dB
+        float onset;        // flux above its recent mean, dB
+    };
+
+    enum
+    {
+        FEATURES_HISTORY = 256
+    };
+
+    VisualFeatures();
+    ~VisualFeatures();
+
+    VisualFeatures(const VisualFeatures &) = delete;
+    VisualFeatures &operator=(const VisualFeatures &) = delete;
+
+    /*!
+     * Sets the sample rate and the transform size of the spectra to come.
+     */
+    void setFormat(int sampleRate, int size);
+    inline int sampleRate() const { return m_sampleRate; }
+    /*!
+     * Drops the flux history, for spectra that do not follow the last one.
+     */
+    void clear();
+    /*!
+     * Same as calc_levels on count power values, power[0] being bin first,
+     * recording the features of the spectrum on the way.
+     */
+    void process(const float *power, float *levels, int count, int first, float floor_db, float range_db);
+
+    /*!
+     * Copies the newest record. Returns false when there is none.
+     */
+    bool latest(Record *record) const;
+    /*!
+     * Copies up to count of the newest records, oldest first, and returns
+     * how many were copied.
+     */
+    int history(Record *records, int count) const;
+
+private:
+    struct Slot
+    {
+        // odd while the record is being written
+        std::atomic<quint32> sequence;
+        // the record word by word, atomics as readers may race the writer
+        std::atomic<quint32> words[sizeof(Record) / sizeof(quint32)];
+    };
+
+    bool read(quint64 index, Record *record) const;
+    void push(const Record &record);
+
+    int m_sampleRate = 44100, m_size = 0, m_count = 0;
+    float *m_history = nullptr, *m_partial = nullptr;
+    float m_fluxMean = 0.0f;
+    bool m_continued = false;
+    quint64 m_frames = 0;
+    Slot m_ring[FEATURES_HISTORY];
+    std::atomic<quint64> m_written;
+
+};
+
+#endif
@@ -0,0 +1,211 @@
+#include "visualglpresenter.h"
+
+#ifdef VOICE_OPENGL
+#include <QOpenGLShaderProgram>
+
+static const char *VERTEX_SHADER =
+    "attribute vec2 position;\n"
+    "varying vec2 coord;\n"
+    "void main()\n"
+    "{\n"
+    "    coord = position * 0.5 + 0.5;\n"
+    "    gl_Position = vec4(position, 0.0, 1.0);\n"
+    "}\n";
+
+// levels holds a row per column of the history, top line first, shift is
+// the oldest column as a part of all of them
+static const char *FRAGMENT_SHADER =
+    "#ifdef GL_ES\n"
+    "precision highp float;\n"
+    "#endif\n"
+    "uniform sampler2D levels;\n"
+    "uniform sampler2D colors;\n"
+    "uniform float shift;\n"
+    "varying vec2 coord;\n"
+    "void main()\n"
+    "{\n"
+    "    float level = texture2D(levels, vec2(1.0 - coord.y, fract(coord.x + shift))).r;\n"
+    "    gl_FragColor = texture2D(colors, vec2((level * 255.0 + 0.5) / 256.0, 0.5));\n"
+    "}\n";
+
+static const GLfloat VERTICES[] = {-1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f};
+
+VisualGLPresenter::VisualGLPresenter(QWidget *parent)
+    : QOpenGLWidget(parent)
+{
+
+}
+
+VisualGLPresenter::~VisualGLPresenter()
+{
+    if(m_valid && isValid())
+    {
+        makeCurrent();
+        delete m_program;
+        glDeleteTextures(1, &m_levelsTexture);
+        glDeleteTextures(1, &m_colorsTexture);
+        doneCurrent();
+    }
+}
+
+void VisualGLPresenter::setHistory(const uchar *history, int width, int height)
+{
+    m_history = history;
+    m_width = width;
+    m_height = height;
+    m_shift = 0;
+    m_count = 0;
+    m_reload = true;
+    update();
+}
+
+void VisualGLPresenter::setColorTable(const QVector<QRgb> &colors)
+{
+    m_colors = colors;
+    m_colorsChanged = true;
+    update();
+}
+
+void VisualGLPresenter::updateColumns(int first, int count, int shift)
+{
+    if(m_width <= 0)
+    {
+        return;
+    }
+
+    // columns arrive in order, so the changed ones stay a single run
+    m_count = qMin(m_count + count, m_width);
+    m_first = ((first + count - m_count) % m_width + m_width) % m_width;
+    m_shift = shift;
+    update();
+}
+
+void VisualGLPresenter::initializeGL()
+{
+    initializeOpenGLFunctions();
+
+    m_program = new QOpenGLShaderProgram;
+    m_program->bindAttributeLocation("position", 0);
+    if(!m_program->addShaderFromSourceCode(QOpenGLShader::Vertex, VERTEX_SHADER) ||
+       !m_program->addShaderFromSourceCode(QOpenGLShader::Fragment, FRAGMENT_SHADER) ||
+       !m_program->link())
+    {
+        delete m_program;
+        m_program = nullptr;
+        fail();
+        return;
+    }
+
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &m_maxTextureSize);
+    for(GLuint *texture : {&m_levelsTexture, &m_colorsTexture})
+    {
+        glGenTextures(1, texture);
+        glBindTexture(GL_TEXTURE_2D, *texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    m_valid = true;
+    m_reload = true;
+    m_colorsChanged = true;
+}
+
+void VisualGLPresenter::paintGL()
+{
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    if(!m_valid || !m_history || m_width <= 0 || m_height <= 0)
+    {
+        return;
+    }
+
+    if(m_width > m_maxTextureSize || m_height > m_maxTextureSize)
+    {
+        fail();
+        return;
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if(m_colorsChanged)
+    {
+        uchar colors[256 * 4] = {0};
+        for(int i = 0; i < qMin(m_colors.count(), 256); ++i)
+        {
+            colors[4 * i + 0] = qRed(m_colors[i]);
+            colors[4 * i + 1] = qGreen(m_colors[i]);
+            colors[4 * i + 2] = qBlue(m_colors[i]);
+            colors[4 * i + 3] = 0xFF;
+        }
+
+        glBindTexture(GL_TEXTURE_2D, m_colorsTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, colors);
+        m_colorsChanged = false;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, m_levelsTexture);
+    if(m_reload)
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, m_height, m_width, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, m_history);
+        m_reload = false;
+    }
+    else if(m_count > 0)
+    {
+        uploadColumns(m_first, m_count);
+    }
+    m_count = 0;
+
+    // the history is centred like the image of the painter path
+    const qreal ratio = devicePixelRatioF();
+    const int y = height() - (height() - m_height) / 2 - m_height;
+    glViewport(0, qRound(y * ratio), qRound(m_width * ratio), qRound(m_height * ratio));
+
+    m_program->bind();
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, m_colorsTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_levelsTexture);
+    m_program->setUniformValue("levels", 0);
+    m_program->setUniformValue("colors", 1);
+    m_program->setUniformValue("shift", GLfloat(m_shift) / m_width);
+
+    m_program->enableAttributeArray(0);
+    m_program->setAttributeArray(0, GL_FLOAT, VERTICES, 2);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    m_program->disableAttributeArray(0);
+    m_program->release();
+}
+
+void VisualGLPresenter::paintEvent(QPaintEvent *e)
+{
+    QOpenGLWidget::paintEvent(e);
+
+    // the context is created before the first paint, or never
+    if(!isValid() && !size().isEmpty())
+    {
+        fail();
+    }
+}
+
+void VisualGLPresenter::fail()
+{
+    if(!m_failed)
+    {
+        m_failed = true;
+        QMetaObject::invokeMethod(this, "failed", Qt::QueuedConnection);
+    }
+}
+
+void VisualGLPresenter::uploadColumns(int first, int count)
+{
+    // every column is a row of the texture, contiguous in the history
+    const int head = qMin(count, m_width - first);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, m_height, head, GL_LUMINANCE, GL_UNSIGNED_BYTE, m_history + first * m_height);
+    if(count > head)
+    {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_height, count - head, GL_LUMINANCE, GL_UNSIGNED_BYTE, m_history);
+    }
+}
+#endif
@@ -0,0 +1,85 @@
+/***************************************************************************
+ * This file is part of the TTK qmmp plugin project
+ * Copyright (C) 2015 - 2026 Greedysky Studio
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; If not, see <http://www.gnu.org/licenses/>.
+ ***************************************************************************/
+
+#ifndef VISUALGLPRESENTER_H
+#define VISUALGLPRESENTER_H
+
+#ifdef VOICE_OPENGL
+#include <QVector>
+#include <QOpenGLWidget>
+#include <QOpenGLFunctions>
+
+class QOpenGLShaderProgram;
+
+/*!
+ * Presents the spectrogram history through OpenGL. The history stays in
+ * a texture with one row per column, only the columns that changed are
+ * uploaded and scrolling only moves the texture coordinates. Levels are
+ * colored in the fragment shader from the color table.
+ * When OpenGL is not usable, failed() is emitted once and nothing is drawn.
+ * @author Greedysky <greedysky@163.com>
+ */
+class VisualGLPresenter : public QOpenGLWidget, protected QOpenGLFunctions
+{
+    Q_OBJECT
+public:
+    explicit VisualGLPresenter(QWidget *parent = nullptr);
+    virtual ~VisualGLPresenter();
+
+    /*!
+     * Shows a history of width columns of height levels, each column stored
+     * top line first. The history is read until the next call, which
+     * uploads it in full.
+     */
+    void setHistory(const uchar *history, int width, int height);
+    /*!
+     * Sets the colors of the 256 levels.
+     */
+    void setColorTable(const QVector<QRgb> &colors);
+    /*!
+     * Marks count columns from first on as changed, wrapping around the
+     * history, and moves the oldest column to shift.
+     */
+    void updateColumns(int first, int count, int shift);
+
+signals:
+    void failed();
+
+private:
+    virtual void initializeGL() override final;
+    virtual void paintGL() override final;
+    virtual void paintEvent(QPaintEvent *e) override final;
+
+    void fail();
+    void uploadColumns(int first, int count);
+
+    QOpenGLShaderProgram *m_program = nullptr;
+    GLuint m_levelsTexture = 0, m_colorsTexture = 0;
+    GLint m_maxTextureSize = 0;
+    bool m_valid = false, m_failed = false;
+    const uchar *m_history = nullptr;
+    int m_width = 0, m_height = 0, m_shift = 0;
+    // columns changed since the last paint, all of them when m_reload is set
+    int m_first = 0, m_count = 0;
+    bool m_reload = false, m_colorsChanged = false;
+    QVector<QRgb> m_colors;
+
+};
+#endif
+
+#endif
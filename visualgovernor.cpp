@@ -0,0 +1,90 @@
+#include "visualgovernor.h"
+
+// weight of the newest frame in the running load
+#define LOAD_SMOOTHING  0.1f
+// frames skipped after a step while the caches and layouts settle
+#define SETTLE_FRAMES   25
+// frames over the budget before stepping down
+#define OVER_FRAMES     10
+// frames under UNDER_SHARE of the budget before stepping up, as a step up
+// about doubles the cost, and the most the wait grows to
+#define UNDER_FRAMES    100
+#define UNDER_SHARE     0.4f
+#define UNDER_FRAMES_MAX (8 * UNDER_FRAMES)
+
+static const VisualGovernor::Quality QUALITIES[VisualGovernor::TIER_COUNT] = {
+    {1024, 360, 25},
+    {512, 270, 40},
+    {256, 180, 50},
+    {256, 135, 66}
+};
+
+const VisualGovernor::Quality &VisualGovernor::quality(Tier tier)
+{
+    return QUALITIES[tier];
+}
+
+VisualGovernor::VisualGovernor()
+    : m_patience(UNDER_FRAMES)
+{
+}
+
+void VisualGovernor::setBudget(int percent)
+{
+    m_budget = qMax(percent, 0);
+    m_patience = UNDER_FRAMES;
+    m_raised = false;
+    step(TIER_DEFAULT);
+}
+
+bool VisualGovernor::update(qint64 cost, qint64 elapsed)
+{
+    if(m_budget == 0 || elapsed <= 0)
+    {
+        return false;
+    }
+
+    if(m_settling > 0)
+    {
+        --m_settling;
+        return false;
+    }
+
+    // the running load starts from the first frame after a step
+    const float load = 100.0f * cost / elapsed;
+    m_load = m_load < 0.0f ? load : m_load + LOAD_SMOOTHING * (load - m_load);
+    ++m_held;
+    m_over = m_load > m_budget ? m_over + 1 : 0;
+    m_under = m_load < UNDER_SHARE * m_budget ? m_under + 1 : 0;
+
+    if(m_over >= OVER_FRAMES && m_tier < TIER_LOWEST)
+    {
+        // a step up that could not be kept for long is tried less eagerly
+        if(m_raised && m_held < UNDER_FRAMES_MAX)
+        {
+            m_patience = qMin(2 * m_patience, UNDER_FRAMES_MAX);
+        }
+        m_raised = false;
+        step(Tier(m_tier + 1));
+        return true;
+    }
+
+    if(m_under >= m_patience && m_tier > TIER_HIGH)
+    {
+        m_raised = true;
+        step(Tier(m_tier - 1));
+        return true;
+    }
+
+    return false;
+}
+
+void VisualGovernor::step(Tier tier)
+{
+    m_tier = tier;
+    m_settling = SETTLE_FRAMES;
+    m_over = 0;
+    m_under = 0;
+    m_held = 0;
+    m_load = -1.0f;
+}
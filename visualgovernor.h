@@ -0,0 +1,92 @@
+/***************************************************************************
+ * This file is part of the TTK qmmp plugin project
+ * Copyright (C) 2015 - 2026 Greedysky Studio
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; If not, see <http://www.gnu.org/licenses/>.
+ ***************************************************************************/
+
+#ifndef VISUALGOVERNOR_H
+#define VISUALGOVERNOR_H
+
+#include <QtGlobal>
+
+/*!
+ * Picks the quality tier the spectrogram runs at from the measured cost of
+ * its frames. The analysis and paint time of each frame is weighed against
+ * the time the frame lasted; the tier steps down once that share stays
+ * above the budget and back up once it stays well below it. Every step is
+ * followed by a settling period, and a step up that had to be taken back
+ * makes the next one wait twice as long.
+ * @author Greedysky <greedysky@163.com>
+ */
+class VisualGovernor
+{
+public:
+    enum Tier
+    {
+        TIER_HIGH,
+        TIER_NORMAL,
+        TIER_LOW,
+        TIER_LOWEST,
+        TIER_COUNT,
+        TIER_DEFAULT = TIER_NORMAL
+    };
+
+    struct Quality
+    {
+        int size;       // frame size of the linear analysis
+        int rows;       // rows of each channel at most
+        int interval;   // ms between frames
+    };
+
+    /*!
+     * Returns what is drawn at a tier.
+     */
+    static const Quality &quality(Tier tier);
+
+    VisualGovernor();
+
+    /*!
+     * Sets the share of each frame, in percent of one CPU, that analysis
+     * and paint may take. With 0 the default tier is held.
+     */
+    void setBudget(int percent);
+    inline int budget() const { return m_budget; }
+    inline Tier tier() const { return m_tier; }
+
+    /*!
+     * Takes the cost of a frame and the time it lasted, both in ns.
+     * Returns true when the tier changed.
+     */
+    bool update(qint64 cost, qint64 elapsed);
+
+private:
+    void step(Tier tier);
+
+    int m_budget = 0;
+    Tier m_tier = TIER_DEFAULT;
+    // running share of the frames taken, or negative before the first one
+    float m_load = -1.0f;
+    // frames left to settle, frames measured since the last step and
+    // frames the load has been over or well under the budget for
+    int m_settling = 0, m_held = 0;
+    int m_over = 0, m_under = 0;
+    // frames under the budget a step up waits for, and whether the last
+    // step was one
+    int m_patience;
+    bool m_raised = false;
+
+};
+
+#endif
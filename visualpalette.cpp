@@ -3,14 +3,18 @@
 #include <QColor>
 #include <QVector>
 #include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846	/* pi */
 #endif
-#define GRADIENT_TABLE_SIZE 256
+// entries of the table every palette is baked into on first use
+#define PALETTE_TABLE_SIZE 4096
 
-static bool __globalTableInit__ = false;
-static uint32_t __globalTableGolors__[GRADIENT_TABLE_SIZE];
 static QVector<QColor> __globalGolors__ = { QColor(0, 0, 0),
                                             QColor(0, 32, 100),
                                             QColor(0, 120, 160),
@@ -20,49 +24,6 @@ static QVector<QColor> __globalGolors__ = { QColor(0, 0, 0),
                                             QColor(255, 0, 0)
                                           };
 
-static void createGradientTable()
-{
-    constexpr int numbers = 6;
-    for(int i = 0; i < GRADIENT_TABLE_SIZE; ++i)
-    {
-        double position = i * 1.0 / GRADIENT_TABLE_SIZE;
-        /* if position > 1 then we have repetition of colors it maybe useful    */
-        if(position > 1.0)
-        {
-            if(position - int(position) == 0.0)
-            {
-                position = 1.0;
-            }
-            else
-            {
-                position = position - int(position);
-            }
-        }
-
-        const double m = numbers * position;
-        const int n = (int)m; // integer of m
-        const double f = m - n;  // fraction of m
-
-        __globalTableGolors__[i] = 0xFF0000;
-        if(n < numbers)
-        {
-            __globalTableGolors__[i] = ((uint32_t)((__globalGolors__[n].red()) + f * ((__globalGolors__[n + 1].red()) - (__globalGolors__[n].red()))) & 0xFF) << 16 |
-                                       ((uint32_t)((__globalGolors__[n].green()) + f * ((__globalGolors__[n + 1].green()) - (__globalGolors__[n].green()))) & 0xFF) << 8 |
-                                       ((uint32_t)((__globalGolors__[n].blue()) + f * ((__globalGolors__[n + 1].blue()) - (__globalGolors__[n].blue()))) & 0xFF) << 0;
-        }
-        else if(n == numbers)
-        {
-            __globalTableGolors__[i] = ((uint32_t)(__globalGolors__[n].red()) & 0xFF) << 16 |
-                                       ((uint32_t)(__globalGolors__[n].green()) & 0xFF) << 8 |
-                                       ((uint32_t)(__globalGolors__[n].blue()) & 0xFF) << 0;
-        }
-        else
-        {
-            __globalTableGolors__[i] = 0xFFFFFF;
-        }
-    }
-}
-
 // Modified version of Dan Bruton's algorithm:
 // http://www.physics.sfasu.edu/astro/color/spectra.html
 static uint32_t spectrum(double level)
@@ -118,14 +79,22 @@ static uint32_t spectrum(double level)
 
 static uint32_t perceptual(double level)
 {
-    if(!__globalTableInit__)
+    constexpr int numbers = 6;
+    const double position = qBound(0.0, level, 1.0);
+    const double m = numbers * position;
+    const int n = (int)m; // integer of m
+    const double f = m - n;  // fraction of m
+
+    if(n < numbers)
     {
-        createGradientTable();
-        __globalTableInit__ = true;
+        return ((uint32_t)((__globalGolors__[n].red()) + f * ((__globalGolors__[n + 1].red()) - (__globalGolors__[n].red()))) & 0xFF) << 16 |
+               ((uint32_t)((__globalGolors__[n].green()) + f * ((__globalGolors__[n + 1].green()) - (__globalGolors__[n].green()))) & 0xFF) << 8 |
+               ((uint32_t)((__globalGolors__[n].blue()) + f * ((__globalGolors__[n + 1].blue()) - (__globalGolors__[n].blue()))) & 0xFF) << 0;
     }
 
-    const int index = qBound(0, int(level * GRADIENT_TABLE_SIZE), GRADIENT_TABLE_SIZE - 1);
-    return __globalTableGolors__[index];
+    return ((uint32_t)(__globalGolors__[numbers].red()) & 0xFF) << 16 |
+           ((uint32_t)(__globalGolors__[numbers].green()) & 0xFF) << 8 |
+           ((uint32_t)(__globalGolors__[numbers].blue()) & 0xFF) << 0;
 }
 
 static uint32_t rainbow(double level)
@@ -379,21 +348,92 @@ static uint32_t mono(double level)
 }
 
 
+typedef uint32_t (*PaletteFunction)(double level);
+
+struct PaletteTable
+{
+    explicit PaletteTable(PaletteFunction function)
+    {
+        for(int i = 0; i < PALETTE_TABLE_SIZE; ++i)
+        {
+            colors[i] = 0xFF000000 | function(double(i) / (PALETTE_TABLE_SIZE - 1));
+        }
+    }
+
+    uint32_t colors[PALETTE_TABLE_SIZE];
+};
+
+template <PaletteFunction function>
+static const uint32_t *paletteTable()
+{
+    // built on first use, static initialization makes that happen once
+    // even when several threads get here together
+    static const PaletteTable table(function);
+    return table.colors;
+}
+
+
+static const uint32_t *paletteTable(VisualPalette::Palette palette)
+{
+    switch(palette)
+    {
+    case VisualPalette::PALETTE_SPECTRUM: return paletteTable<spectrum>();
+    case VisualPalette::PALETTE_PERCEPTUAL: return paletteTable<perceptual>();
+    case VisualPalette::PALETTE_RAINBOW: return paletteTable<rainbow>();
+    case VisualPalette::PALETTE_SOX: return paletteTable<sox>();
+    case VisualPalette::PALETTE_MAGMA: return paletteTable<magma>();
+    case VisualPalette::PALETTE_LINAS: return paletteTable<linas>();
+    case VisualPalette::PALETTE_CUBEHELIX: return paletteTable<cubeHelix>();
+    case VisualPalette::PALETTE_FRACTALIZER: return paletteTable<fractalizer>();
+    case VisualPalette::PALETTE_MONO: return paletteTable<mono>();
+    default: return nullptr;
+    }
+}
+
+
 namespace VisualPalette {
 uint32_t renderPalette(Palette palette, double level)
 {
-    switch(palette)
+    const float value = level;
+    uint32_t color;
+    renderColumn(palette, &value, &color, 1);
+    return color;
+}
+
+void renderColumn(Palette palette, const float *levels, uint32_t *out, int n, float scale)
+{
+    const uint32_t *table = paletteTable(palette);
+    if(!table)
+    {
+        memset(out, 0, n * sizeof(uint32_t));
+        return;
+    }
+
+    const float factor = scale * (PALETTE_TABLE_SIZE - 1);
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128 vfactor = _mm_set1_ps(factor), half = _mm_set1_ps(0.5f);
+    const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(PALETTE_TABLE_SIZE - 1);
+    int32_t index[4];
+
+    for(; i + 4 <= n; i += 4)
+    {
+        // a NaN level ends up at the lowest entry
+        __m128 x = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(levels + i), vfactor), half);
+        x = _mm_min_ps(_mm_max_ps(x, lo), hi);
+        _mm_storeu_si128((__m128i *)index, _mm_cvttps_epi32(x));
+        out[i] = table[index[0]];
+        out[i + 1] = table[index[1]];
+        out[i + 2] = table[index[2]];
+        out[i + 3] = table[index[3]];
+    }
+#endif
+
+    for(; i < n; ++i)
     {
-    case PALETTE_SPECTRUM: return spectrum(level);
-    case PALETTE_PERCEPTUAL: return perceptual(level);
-    case PALETTE_RAINBOW: return rainbow(level);
-    case PALETTE_SOX: return sox(level);
-    case PALETTE_MAGMA: return magma(level);
-    case PALETTE_LINAS: return linas(level);
-    case PALETTE_CUBEHELIX: return cubeHelix(level);
-    case PALETTE_FRACTALIZER: return fractalizer(level);
-    case PALETTE_MONO: return mono(level);
-    default: return 0;
+        const float x = levels[i] * factor + 0.5f;
+        out[i] = table[!(x > 0.0f) ? 0 : (x >= PALETTE_TABLE_SIZE - 1 ? PALETTE_TABLE_SIZE - 1 : int(x))];
     }
 }
 }
@@ -39,9 +39,14 @@ enum Palette
 };
 
 /*!
-* Returns visual render palette by type.
+* Returns visual render palette by type, as 0xffRRGGBB.
 */
 uint32_t renderPalette(Palette palette, double level);
+/*!
+* Renders n levels, each multiplied by scale first, into the colors of a
+* palette as above.
+*/
+void renderColumn(Palette palette, const float *levels, uint32_t *out, int n, float scale = 1.0f);
 
 }
 
@@ -0,0 +1,218 @@
+#include "visualreassignment.h"
+#include "spectrum.h"
+
+#include <cmath>
+#include <cstring>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846	/* pi */
+#endif
+
+VisualReassignment::VisualReassignment(int size)
+    : m_size(size)
+{
+    // room for a full frame plus several nodes arriving in one go
+    m_capacity = 4 * qMax(m_size, 512);
+    m_left = new float[2 * m_capacity]{0};
+    m_right = new float[2 * m_capacity]{0};
+    m_hop = m_size;
+
+    for(int i = 0; i < 3; ++i)
+    {
+        m_windows[i] = new float[m_size];
+    }
+
+    for(int i = 0; i < 12; ++i)
+    {
+        m_spectra[i] = new float[m_size / 2 + 1];
+    }
+
+    m_state = fft_init_size(m_size);
+    createWindows();
+    createHistogram();
+}
+
+VisualReassignment::~VisualReassignment()
+{
+    fft_close(m_state);
+    for(int i = 0; i < 3; ++i)
+    {
+        delete[] m_windows[i];
+    }
+
+    for(int i = 0; i < 12; ++i)
+    {
+        delete[] m_spectra[i];
+    }
+
+    delete[] m_histogram;
+    delete[] m_left;
+    delete[] m_right;
+}
+
+void VisualReassignment::setWindow(VisualSTFT::Window window)
+{
+    if(m_windowType != window)
+    {
+        m_windowType = window;
+        createWindows();
+    }
+}
+
+void VisualReassignment::setHopSize(int hop)
+{
+    hop = qBound(1, hop, m_size);
+    if(m_hop != hop)
+    {
+        m_hop = hop;
+        createHistogram();
+    }
+}
+
+void VisualReassignment::setRows(int rows, float lowest, float highest)
+{
+    m_rowScale = rows / std::log2(highest / lowest);
+    m_rowOffset = -m_rowScale * std::log2(lowest);
+    if(m_rows != rows)
+    {
+        m_rows = rows;
+        createHistogram();
+    }
+}
+
+void VisualReassignment::setThreshold(float power)
+{
+    m_threshold = power;
+}
+
+void VisualReassignment::clear()
+{
+    m_written = 0;
+    m_next = 0;
+    m_frame = 0;
+    memset(m_histogram, 0, (2 * m_reach + 1) * 2 * m_rows * sizeof(float));
+}
+
+void VisualReassignment::append(const float *left, const float *right, int samples)
+{
+    for(int i = 0; i < samples; ++i)
+    {
+        const int index = int(m_written++ % m_capacity);
+        m_left[index] = m_left[index + m_capacity] = left[i];
+        m_right[index] = m_right[index + m_capacity] = right[i];
+    }
+
+    if(m_written - m_next > quint64(m_capacity))
+    {
+        m_next = m_written - m_size;
+    }
+}
+
+bool VisualReassignment::next(float *left, float *right)
+{
+    if(!m_state)
+    {
+        return false;
+    }
+
+    const int columns = 2 * m_reach + 1;
+    while(m_next + m_size <= m_written)
+    {
+        const int start = int(m_next % m_capacity);
+        m_next += m_hop;
+
+        // all windows of both channels go through one batch
+        const float *inputs[6] = {m_left + start, m_left + start, m_left + start, m_right + start, m_right + start, m_right + start};
+        const float *windows[6] = {m_windows[0], m_windows[1], m_windows[2], m_windows[0], m_windows[1], m_windows[2]};
+        fft_perform_complex_batch(inputs, windows, m_spectra, right ? 6 : 3, m_state);
+
+        reassign(m_spectra, 0);
+        if(right)
+        {
+            reassign(m_spectra + 6, 1);
+        }
+
+        // no later frame reaches back to the column m_reach before this one
+        float *column = m_histogram + (m_frame++ % columns) * 2 * m_rows;
+        memcpy(left, column, m_rows * sizeof(float));
+        if(right)
+        {
+            memcpy(right, column + m_rows, m_rows * sizeof(float));
+        }
+        memset(column, 0, 2 * m_rows * sizeof(float));
+        return true;
+    }
+    return false;
+}
+
+void VisualReassignment::createWindows()
+{
+    const VisualSTFT::Window window = m_windowType == VisualSTFT::WINDOW_RECTANGULAR ? VisualSTFT::WINDOW_HANN : m_windowType;
+    VisualSTFT::createWindow(window, m_size, m_windows[0], m_windows[1]);
+
+    // time from the centre of the frame
+    double energy = 0.0;
+    for(int i = 0; i < m_size; ++i)
+    {
+        m_windows[2][i] = (i - m_size / 2) * m_windows[0][i];
+        energy += m_windows[0][i] * m_windows[0][i];
+    }
+
+    // a sine's bins add up to its peak power times this window's energy
+    // over that of the rectangular one
+    m_gain = m_size / energy;
+}
+
+void VisualReassignment::createHistogram()
+{
+    // energy moves by half a frame at most
+    m_reach = (m_size / 2 + m_hop - 1) / m_hop;
+    delete[] m_histogram;
+    m_histogram = new float[(2 * m_reach + 1) * 2 * m_rows]();
+    m_frame = 0;
+}
+
+void VisualReassignment::reassign(float *const *spectra, int channel)
+{
+    const float *real = spectra[0], *imag = spectra[1];
+    const float *derivativeReal = spectra[2], *derivativeImag = spectra[3];
+    const float *timeReal = spectra[4], *timeImag = spectra[5];
+    // columns are kept at their index plus m_reach modulo the ring
+    const int columns = 2 * m_reach + 1;
+    const quint64 frame = m_frame + m_reach;
+    // bins of this frame in FFT_BUFFER_SIZE bins, and the frequency of the
+    // derivative term in the same units
+    const float binScale = float(FFT_BUFFER_SIZE) / m_size;
+    const float frequencyScale = FFT_BUFFER_SIZE / (2.0f * M_PI);
+    const float columnScale = 1.0f / m_hop;
+
+    for(int k = 1; k < m_size / 2; ++k)
+    {
+        const float power = real[k] * real[k] + imag[k] * imag[k];
+        if(power < m_threshold || power <= 0.0f)
+        {
+            continue;
+        }
+
+        // instantaneous frequency and group delay from the cross spectra
+        // with the plain one
+        const float inverse = 1.0f / power;
+        const float shift = (derivativeImag[k] * real[k] - derivativeReal[k] * imag[k]) * inverse;
+        const float delay = (timeReal[k] * real[k] + timeImag[k] * imag[k]) * inverse;
+
+        const float position = k * binScale + shift * frequencyScale - 1.0f;
+        if(position <= 0.0f)
+        {
+            continue;
+        }
+
+        const int row = int(m_rowScale * spectrum_log2(position) + m_rowOffset);
+        if(row < 0 || row >= m_rows)
+        {
+            continue;
+        }
+
+        const int offset = qBound(-m_reach, int(std::floor(delay * columnScale + 0.5f)), m_reach);
+        m_histogram[((frame + offset) % columns) * 2 * m_rows + channel * m_rows + row] += power * m_gain;
+    }
+}
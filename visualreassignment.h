@@ -0,0 +1,114 @@
+/***************************************************************************
+ * This file is part of the TTK qmmp plugin project
+ * Copyright (C) 2015 - 2026 Greedysky Studio
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; If not, see <http://www.gnu.org/licenses/>.
+ ***************************************************************************/
+
+#ifndef VISUALREASSIGNMENT_H
+#define VISUALREASSIGNMENT_H
+
+#include "visualstft.h"
+
+/*!
+ * Streaming reassigned spectrogram. Every bin's energy is moved to its
+ * instantaneous frequency and group delay, taken from the transforms of the
+ * same frame under the derivative and the time weighted window, and
+ * gathered into a histogram of display rows for the column it lands in.
+ * @author Greedysky <greedysky@163.com>
+ */
+class VisualReassignment
+{
+public:
+    explicit VisualReassignment(int size = FFT_BUFFER_SIZE);
+    ~VisualReassignment();
+
+    VisualReassignment(const VisualReassignment &) = delete;
+    VisualReassignment &operator=(const VisualReassignment &) = delete;
+
+    /*!
+     * Returns the frame size in samples.
+     */
+    inline int size() const { return m_size; }
+
+    /*!
+     * Sets the analysis window. The rectangular window has no derivative to
+     * speak of, the Hann window is used for it.
+     */
+    void setWindow(VisualSTFT::Window window);
+    inline VisualSTFT::Window window() const { return m_windowType; }
+
+    /*!
+     * Sets the distance between columns in input samples.
+     */
+    void setHopSize(int hop);
+    inline int hopSize() const { return m_hop; }
+
+    /*!
+     * Sets rows spaced logarithmically from lowest to highest, counted in
+     * FFT_BUFFER_SIZE bins from the first one above the constant term.
+     */
+    void setRows(int rows, float lowest, float highest);
+    /*!
+     * Sets the power, scaled like that of a size() point fft_perform, below
+     * which bins are left out.
+     */
+    void setThreshold(float power);
+
+    /*!
+     * Drops all buffered samples and unfinished columns.
+     */
+    void clear();
+    /*!
+     * Appends samples of both channels. When the caller falls behind by more
+     * than the ring holds, the oldest unanalysed samples are dropped.
+     */
+    void append(const float *left, const float *right, int samples);
+    /*!
+     * Finishes the next column into the power of each row, scaled so that a
+     * sine gives its size() point fft_perform peak, both
+     * channels or only the left one when right is null. Energy may be moved
+     * by up to half a frame, so columns come out that much late. Returns
+     * false when no column is due.
+     */
+    bool next(float *left, float *right);
+    /*!
+     * Returns the samples appended since the centre of the newest column.
+     */
+    inline int delay() const { return int(qint64(m_written) - qint64(m_next) + m_hop - m_size / 2) + m_reach * m_hop; }
+
+private:
+    void createWindows();
+    void createHistogram();
+    void reassign(float *const *spectra, int channel);
+
+    int m_size, m_capacity, m_hop;
+    VisualSTFT::Window m_windowType = VisualSTFT::WINDOW_DEFAULT;
+    // plain, derivative and time weighted window
+    float *m_windows[3];
+    // each ring holds its samples twice, so every frame is contiguous
+    float *m_left, *m_right;
+    quint64 m_written = 0, m_next = 0, m_frame = 0;
+    // real and imaginary parts of the three spectra of each channel
+    float *m_spectra[12];
+    int m_rows = 0;
+    float m_rowScale = 0.0f, m_rowOffset = 0.0f, m_threshold = 0.0f, m_gain = 1.0f;
+    // 2 * m_reach + 1 unfinished columns of two channels each
+    int m_reach = 0;
+    float *m_histogram = nullptr;
+    fft_state *m_state;
+
+};
+
+#endif
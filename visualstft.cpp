@@ -0,0 +1,262 @@
+#include "visualstft.h"
+
+#include <cmath>
+#include <cstring>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846	/* pi */
+#endif
+#define KAISER_BETA 8.6
+
+// zeroth order modified Bessel function of the first kind
+static double besselI0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for(int k = 1; k < 32; ++k)
+    {
+        const double f = x / (2.0 * k);
+        term *= f * f;
+        sum += term;
+        if(term < sum * 1e-12)
+        {
+            break;
+        }
+    }
+    return sum;
+}
+
+// window at a possibly fractional sample position i of n
+static double windowValue(VisualSTFT::Window window, double i, int n)
+{
+    const double x = 2.0 * M_PI * i / n;
+
+    switch(window)
+    {
+    case VisualSTFT::WINDOW_HANN:
+        return 0.5 - 0.5 * std::cos(x);
+    case VisualSTFT::WINDOW_BLACKMAN_HARRIS:
+        return 0.35875 - 0.48829 * std::cos(x) + 0.14128 * std::cos(2 * x) - 0.01168 * std::cos(3 * x);
+    case VisualSTFT::WINDOW_KAISER:
+    {
+        const double r = 2.0 * i / n - 1.0;
+        return besselI0(KAISER_BETA * std::sqrt(qMax(0.0, 1.0 - r * r))) / besselI0(KAISER_BETA);
+    }
+    default: return 1.0;
+    }
+}
+
+
+VisualSTFT::VisualSTFT(int size)
+{
+    initialize({size});
+}
+
+VisualSTFT::VisualSTFT(const QList<int> &sizes)
+{
+    initialize(sizes);
+}
+
+VisualSTFT::~VisualSTFT()
+{
+    for(const Resolution &resolution : m_resolutions)
+    {
+        fft_close(resolution.state);
+        delete[] resolution.window;
+    }
+    delete[] m_left;
+    delete[] m_right;
+}
+
+void VisualSTFT::setWindow(Window window)
+{
+    if(m_windowType != window)
+    {
+        m_windowType = window;
+        createWindow();
+    }
+}
+
+void VisualSTFT::setHopSize(int hop)
+{
+    m_hop = qBound(1, hop, m_size);
+}
+
+void VisualSTFT::reserve(int samples)
+{
+    const int capacity = m_size + samples;
+    if(capacity > m_capacity)
+    {
+        m_capacity = capacity;
+        delete[] m_left;
+        delete[] m_right;
+        m_left = new float[2 * m_capacity]{0};
+        m_right = new float[2 * m_capacity]{0};
+        clear();
+    }
+}
+
+void VisualSTFT::clear()
+{
+    m_written = 0;
+    m_next = 0;
+
+    for(Resolution &resolution : m_resolutions)
+    {
+        resolution.due = 0;
+    }
+}
+
+void VisualSTFT::append(const float *left, const float *right, int samples)
+{
+    for(int i = 0; i < samples; ++i)
+    {
+        const int index = int(m_written++ % m_capacity);
+        m_left[index] = m_left[index + m_capacity] = left[i];
+        m_right[index] = m_right[index + m_capacity] = right[i];
+    }
+
+    if(m_written - m_next > quint64(m_capacity))
+    {
+        m_next = m_written - m_size;
+    }
+}
+
+bool VisualSTFT::next(float *left, float *right)
+{
+    int updated;
+    return next(&left, right ? &right : nullptr, &updated);
+}
+
+bool VisualSTFT::next(float *const *left, float *const *right, int *updated)
+{
+    return next(left, right, updated, 1) > 0;
+}
+
+int VisualSTFT::next(float *const *left, float *const *right, int *updated, int count)
+{
+    const int resolutions = m_resolutions.count();
+    const int last = resolutions - 1;
+    for(Resolution &resolution : m_resolutions)
+    {
+        resolution.inputs.resize(0);
+        resolution.outputs.resize(0);
+    }
+
+    // the frames stay in the ring until the next append, so they are only
+    // gathered here and transformed together below
+    int frames = 0;
+    for(; frames < count && m_next + m_size <= m_written; ++frames)
+    {
+        // all frames are centred on the middle of the largest one
+        const quint64 centre = m_next + m_size / 2;
+        m_next += m_hop;
+        updated[frames] = 0;
+
+        for(int i = 0; i <= last; ++i)
+        {
+            Resolution &resolution = m_resolutions[i];
+            if(!resolution.state || centre < resolution.due)
+            {
+                continue;
+            }
+
+            resolution.due = centre + (i == last ? 0 : qMax(m_hop, resolution.size / 2));
+            const int start = int((centre - resolution.size / 2) % m_capacity);
+            const int output = frames * resolutions + i;
+
+            resolution.inputs.append(m_left + start);
+            resolution.outputs.append(left[output]);
+            if(right)
+            {
+                resolution.inputs.append(m_right + start);
+                resolution.outputs.append(right[output]);
+            }
+            updated[frames] |= 1 << i;
+        }
+    }
+
+    for(Resolution &resolution : m_resolutions)
+    {
+        transform(&resolution, right);
+    }
+    return frames;
+}
+
+void VisualSTFT::transform(Resolution *resolution, bool stereo)
+{
+    // whole groups of lanes go through the batch, which beats a stereo
+    // transform per frame on every kernel that has one; lanes are even, so
+    // the frames left over still come in pairs
+    const int count = resolution->inputs.count();
+    const int lanes = int(fft_batch_lanes(resolution->state));
+    const int batched = lanes > 1 ? count / lanes * lanes : 0;
+    const float *const *inputs = resolution->inputs.constData();
+    float *const *outputs = resolution->outputs.constData();
+
+    if(batched > 0)
+    {
+        fft_perform_batch(inputs, outputs, batched, resolution->state);
+    }
+
+    for(int i = batched; i < count; i += stereo ? 2 : 1)
+    {
+        if(stereo)
+        {
+            fft_perform_stereo(inputs[i], inputs[i + 1], outputs[i], outputs[i + 1], resolution->state);
+        }
+        else
+        {
+            fft_perform(inputs[i], outputs[i], resolution->state);
+        }
+    }
+}
+
+void VisualSTFT::initialize(const QList<int> &sizes)
+{
+    m_size = 0;
+    for(int size : sizes)
+    {
+        m_resolutions.append({size, new float[size], fft_init_size(size), 0, {}, {}});
+        m_size = qMax(m_size, size);
+    }
+
+    // room for the largest frame plus several nodes arriving in one go
+    m_capacity = 4 * qMax(m_size, 512);
+    m_left = new float[2 * m_capacity]{0};
+    m_right = new float[2 * m_capacity]{0};
+    m_hop = m_resolutions.last().size;
+
+    createWindow();
+}
+
+void VisualSTFT::createWindow()
+{
+    for(const Resolution &resolution : m_resolutions)
+    {
+        createWindow(m_windowType, resolution.size, resolution.window);
+        if(resolution.state)
+        {
+            fft_set_window(resolution.state, m_windowType == WINDOW_RECTANGULAR ? nullptr : resolution.window);
+        }
+    }
+}
+
+void VisualSTFT::createWindow(Window window, int n, float *values, float *derivative)
+{
+    double sum = 0.0;
+    for(int i = 0; i < n; ++i)
+    {
+        sum += windowValue(window, i, n);
+    }
+
+    const double scale = n / sum;
+    for(int i = 0; i < n; ++i)
+    {
+        values[i] = windowValue(window, i, n) * scale;
+        if(derivative)
+        {
+            // central difference half a sample to either side
+            derivative[i] = (windowValue(window, i + 0.5, n) - windowValue(window, i - 0.5, n)) * scale;
+        }
+    }
+}
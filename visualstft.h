@@ -0,0 +1,152 @@
+/***************************************************************************
+ * This file is part of the TTK qmmp plugin project
+ * Copyright (C) 2015 - 2026 Greedysky Studio
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; If not, see <http://www.gnu.org/licenses/>.
+ ***************************************************************************/
+
+#ifndef VISUALSTFT_H
+#define VISUALSTFT_H
+
+#include <QList>
+#include <QVector>
+#include "fft.h"
+
+/*!
+ * Streaming short time Fourier transform. Samples are appended as they
+ * arrive and frames of size() samples are transformed every hopSize()
+ * samples, windowed while the transform reads them straight out of the
+ * ring buffer.
+ * With several resolutions, frames of every size share the ring and the
+ * window type and are centred on the same instant. The smallest size is
+ * transformed every hop, larger ones once they moved on by half a frame.
+ * @author Greedysky <greedysky@163.com>
+ */
+class VisualSTFT
+{
+public:
+    enum Window
+    {
+        WINDOW_RECTANGULAR,
+        WINDOW_HANN,
+        WINDOW_BLACKMAN_HARRIS,
+        WINDOW_KAISER,
+        WINDOW_COUNT,
+        WINDOW_DEFAULT = WINDOW_HANN,
+    };
+
+    explicit VisualSTFT(int size = FFT_BUFFER_SIZE);
+    /*!
+     * Creates one resolution per size, largest first.
+     */
+    explicit VisualSTFT(const QList<int> &sizes);
+    ~VisualSTFT();
+
+    VisualSTFT(const VisualSTFT &) = delete;
+    VisualSTFT &operator=(const VisualSTFT &) = delete;
+
+    /*!
+     * Returns the number of resolutions.
+     */
+    inline int resolutions() const { return m_resolutions.count(); }
+    /*!
+     * Returns the frame size in samples of a resolution.
+     */
+    inline int size(int resolution = 0) const { return m_resolutions[resolution].size; }
+
+    /*!
+     * Sets the analysis window, normalized to unit mean so levels stay
+     * comparable between windows.
+     */
+    void setWindow(Window window);
+    inline Window window() const { return m_windowType; }
+    /*!
+     * Fills n values of a window normalized to unit mean and, unless it is
+     * null, its derivative per sample.
+     */
+    static void createWindow(Window window, int n, float *values, float *derivative = nullptr);
+
+    /*!
+     * Sets the distance between frame starts, between 1 and the largest
+     * size.
+     */
+    void setHopSize(int hop);
+    inline int hopSize() const { return m_hop; }
+    /*!
+     * Makes room for samples appended in one go before the frames they
+     * complete are taken, on top of the largest frame. Drops all buffered
+     * samples when the ring grows.
+     */
+    void reserve(int samples);
+
+    /*!
+     * Drops all buffered samples.
+     */
+    void clear();
+    /*!
+     * Appends samples of both channels. When the caller falls behind by more
+     * than the ring holds, the oldest unanalysed samples are dropped.
+     */
+    void append(const float *left, const float *right, int samples);
+    /*!
+     * Transforms the next due frame into power spectra of size() / 2 + 1
+     * values, both channels at once or only the left one when right is null.
+     * Returns false when no frame is due.
+     */
+    bool next(float *left, float *right);
+    /*!
+     * Same as above for every resolution, into left[i] and right[i] sized
+     * size(i) / 2 + 1. Only due resolutions are transformed, updated gets
+     * bit i set for each of them.
+     */
+    bool next(float *const *left, float *const *right, int *updated);
+    /*!
+     * Same as above for up to count due frames at once, the frames of each
+     * resolution going through batched transforms where the kernel has them.
+     * Frame k goes to left[k * resolutions() + i] and right[...] for each
+     * resolution i and sets the bits of updated[k]. Returns the number of
+     * frames transformed.
+     */
+    int next(float *const *left, float *const *right, int *updated, int count);
+    /*!
+     * Returns the samples appended since the centre of the newest frame.
+     */
+    inline int delay() const { return int(qint64(m_written) - qint64(m_next) + m_hop - m_size / 2); }
+
+private:
+    struct Resolution
+    {
+        int size;
+        float *window;
+        fft_state *state;
+        quint64 due;
+        // frames and spectra of the batch being taken, channels in turn
+        QVector<const float *> inputs;
+        QVector<float *> outputs;
+    };
+
+    void initialize(const QList<int> &sizes);
+    void createWindow();
+    void transform(Resolution *resolution, bool stereo);
+
+    int m_size, m_capacity, m_hop = 0;
+    Window m_windowType = WINDOW_DEFAULT;
+    QVector<Resolution> m_resolutions;
+    // each ring holds its samples twice, so every frame is contiguous
+    float *m_left = nullptr, *m_right = nullptr;
+    quint64 m_written = 0, m_next = 0;
+
+};
+
+#endif
@@ -0,0 +1,214 @@
+#include "visualwisdom.h"
+#include "fft.h"
+
+#include <QDir>
+#include <QVector>
+#include <QSettings>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <cmath>
+#include <qmmp/qmmp.h>
+
+/* Bump when kernels change enough to make old measurements meaningless */
+#define WISDOM_VERSION  2
+#define WISDOM_ROUNDS   5
+
+static QString wisdomFile()
+{
+    return QDir(Qmmp::configDir()).filePath("voice.wisdom");
+}
+
+static int supportedKernels()
+{
+    int mask = 0;
+    for(int i = 0; i < FFT_KERNEL_COUNT; ++i)
+    {
+        if(fft_kernel_supported(fft_kernel(i)))
+        {
+            mask |= 1 << i;
+        }
+    }
+    return mask;
+}
+
+static fft_kernel kernelFromName(const QString &name)
+{
+    for(int i = 0; i < FFT_KERNEL_COUNT; ++i)
+    {
+        if(name == fft_kernel_name(fft_kernel(i)) && fft_kernel_supported(fft_kernel(i)))
+        {
+            return fft_kernel(i);
+        }
+    }
+    return FFT_KERNEL_COUNT;
+}
+
+// runs every transform asked for iterations times each
+static void perform(int transforms, int iterations, fft_state *state, const float *input, float *output)
+{
+    const int size = fft_state_size(state);
+    float *const outputs[] = {output, output + size, output + 2 * size, output + 3 * size,
+                              output + 4 * size, output + 5 * size, output + 6 * size, output + 7 * size,
+                              output + 8 * size, output + 9 * size, output + 10 * size, output + 11 * size};
+    const float *const inputs[] = {input, input, input, input, input, input};
+    const float *const windows[] = {nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
+
+    for(int i = 0; i < iterations; ++i)
+    {
+        if(transforms & VisualWisdom::TRANSFORM_REAL)
+        {
+            fft_perform(input, output, state);
+        }
+        if(transforms & VisualWisdom::TRANSFORM_STEREO)
+        {
+            fft_perform_stereo(input, input, outputs[0], outputs[1], state);
+        }
+        if(transforms & VisualWisdom::TRANSFORM_STEREO_COMPLEX)
+        {
+            fft_perform_stereo_complex(input, input, outputs, state);
+        }
+        if(transforms & VisualWisdom::TRANSFORM_COMPLEX_BATCH)
+        {
+            fft_perform_complex_batch(inputs, windows, outputs, 6, state);
+        }
+    }
+}
+
+static fft_kernel benchmark(int size, int transforms, const std::atomic<bool> &stopped)
+{
+    // a plan of its own, the shared one may be in use by another analyzer
+    fft_plan *plan = fft_plan_create(size);
+    fft_state *state = fft_init_plan(plan);
+    if(!state)
+    {
+        fft_plan_destroy(plan);
+        return fft_get_kernel();
+    }
+
+    // room for the 12 outputs of a complex batch
+    QVector<float> input(size), output(12 * size);
+    for(int i = 0; i < size; ++i)
+    {
+        input[i] = 0.5f * std::sin(i * 0.1f) + 0.25f * std::sin(i * 1.7f);
+    }
+
+    // enough transforms per round to dwarf the timer resolution
+    const int iterations = qMax(16, (1 << 18) / size);
+    fft_kernel best = FFT_KERNEL_SCALAR;
+    qint64 bestTime = -1;
+
+    for(int i = 0; i < FFT_KERNEL_COUNT && best != FFT_KERNEL_COUNT; ++i)
+    {
+        const fft_kernel kernel = fft_kernel(i);
+        if(!fft_kernel_supported(kernel))
+        {
+            continue;
+        }
+
+        fft_plan_set_kernel(plan, kernel);
+        perform(transforms, 1, state, input.data(), output.data());
+
+        // best round, to keep preemption out of the result
+        qint64 time = -1;
+        for(int round = 0; round < WISDOM_ROUNDS; ++round)
+        {
+            // given up between rounds, a round is a few ms
+            if(stopped.load(std::memory_order_acquire))
+            {
+                best = FFT_KERNEL_COUNT;
+                break;
+            }
+
+            QElapsedTimer timer;
+            timer.start();
+            perform(transforms, iterations, state, input.data(), output.data());
+
+            const qint64 elapsed = timer.nsecsElapsed();
+            time = time < 0 ? elapsed : qMin(time, elapsed);
+        }
+
+        if(best != FFT_KERNEL_COUNT && (bestTime < 0 || time < bestTime))
+        {
+            bestTime = time;
+            best = kernel;
+        }
+    }
+
+    fft_close(state);
+    fft_plan_destroy(plan);
+    return best;
+}
+
+
+namespace VisualWisdom {
+bool initialize(const QMap<int, int> &transforms, const std::atomic<bool> &stopped)
+{
+    if(fft_kernel_forced())
+    {
+        return true;
+    }
+
+    // transforms already tuned in this process, by size
+    static QMutex mutex;
+    static QMap<int, int> tuned;
+    QMutexLocker locker(&mutex);
+
+    bool done = true;
+    for(auto it = transforms.constBegin(); it != transforms.constEnd() && done; ++it)
+    {
+        done = (tuned.value(it.key()) & it.value()) == it.value();
+    }
+
+    if(done)
+    {
+        return true;
+    }
+
+    QSettings settings(wisdomFile(), QSettings::IniFormat);
+    settings.beginGroup("FFT");
+
+    if(tuned.isEmpty() &&
+       (!qgetenv("FFT_RETUNE").isEmpty() ||
+        settings.value("version").toInt() != WISDOM_VERSION ||
+        settings.value("kernels").toInt() != supportedKernels()))
+    {
+        settings.remove("");
+        settings.setValue("version", WISDOM_VERSION);
+        settings.setValue("kernels", supportedKernels());
+    }
+
+    // given up between sizes and inside the benchmark when stopped, the
+    // sizes left are tuned on the next call
+    done = true;
+    for(auto it = transforms.constBegin(); it != transforms.constEnd() && done; ++it)
+    {
+        const int size = it.key();
+        fft_plan *plan = fft_plan_get(size);
+        if(!plan || (tuned.value(size) & it.value()) == it.value())
+        {
+            continue;
+        }
+
+        const int mix = tuned.value(size) | it.value();
+        const QString key = QString("size_%1_%2").arg(size).arg(mix);
+        fft_kernel kernel = kernelFromName(settings.value(key).toString());
+        if(kernel == FFT_KERNEL_COUNT)
+        {
+            kernel = stopped.load(std::memory_order_acquire) ? FFT_KERNEL_COUNT : benchmark(size, mix, stopped);
+            if(kernel == FFT_KERNEL_COUNT)
+            {
+                done = false;
+                continue;
+            }
+            settings.setValue(key, fft_kernel_name(kernel));
+        }
+
+        fft_plan_set_kernel(plan, kernel);
+        tuned[size] = mix;
+    }
+
+    settings.endGroup();
+    return done;
+}
+
+}
@@ -0,0 +1,53 @@
+/***************************************************************************
+ * This file is part of the TTK qmmp plugin project
+ * Copyright (C) 2015 - 2026 Greedysky Studio
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; If not, see <http://www.gnu.org/licenses/>.
+ ***************************************************************************/
+
+#ifndef VISUALWISDOM_H
+#define VISUALWISDOM_H
+
+#include <QMap>
+#include <atomic>
+
+namespace VisualWisdom {
+enum Transform
+{
+    TRANSFORM_REAL = 0x1,           // fft_perform
+    TRANSFORM_STEREO = 0x2,         // fft_perform_stereo
+    TRANSFORM_STEREO_COMPLEX = 0x4, // fft_perform_stereo_complex
+    TRANSFORM_COMPLEX_BATCH = 0x8   // fft_perform_complex_batch of 6 frames
+};
+
+/*!
+* Gives the FFT plan of each size its fastest kernel for the transforms
+* run at that size, an OR of Transform values.
+* Winners are read from the wisdom file next to the qmmp config, sizes that
+* are missing there are benchmarked once and written back.  Kernels are
+* timed on a plan of their own, only the winner reaches the shared plan.
+* The whole file is discarded when it was written by another wisdom
+* version or on a CPU with other kernels, and when the FFT_RETUNE
+* environment variable is set.
+* Does nothing when FFT_KERNEL forces a kernel.  Takes a while the first
+* time, so better not called from the GUI thread; safe to call from any.
+* Gives up within a benchmark round once stopped is set and returns false,
+* the sizes left are tuned on the next call.  Sizes tuned already cost
+* nothing, not even a look at the file.
+*/
+bool initialize(const QMap<int, int> &transforms, const std::atomic<bool> &stopped);
+
+}
+
+#endif
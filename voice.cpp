@@ -1,16 +1,20 @@
 #include "voice.h"
-#include "inlines.h"
+#include "visualanalyzer.h"
+#include "visualglpresenter.h"
 
 #include <QMenu>
 #include <QTimer>
 #include <QPainter>
 #include <QSettings>
 #include <QActionGroup>
-#include <cmath>
+#ifdef VOICE_OPENGL
+#  include <QHBoxLayout>
+#endif
 #include <qmmp/qmmp.h>
+#include <qmmp/soundcore.h>
 
-#define MIN_ROW     270
-#define MIN_COLUMN  300
+// ms the widget keeps its size before the history takes the new geometry
+#define RESIZE_SETTLE   150
 
 static void adjustMenuPosition(QMenu *menu)
 {
@@ -39,23 +43,47 @@ Voice::Voice(QWidget *parent)
     setWindowTitle(tr("Voice Widget"));
     setMinimumSize(2 * 300 - 30, 105);
 
+    // every pixel is painted, the background need not be erased first
+    setAttribute(Qt::WA_OpaquePaintEvent);
+
     m_timer = new QTimer(this);
-    m_timer->setInterval(40);
     connect(m_timer, SIGNAL(timeout()), SLOT(updateVisual()));
 
+    m_resizeTimer = new QTimer(this);
+    m_resizeTimer->setSingleShot(true);
+    m_resizeTimer->setInterval(RESIZE_SETTLE);
+    connect(m_resizeTimer, SIGNAL(timeout()), SLOT(adjustRows()));
+
     m_channelsAction = new QAction(tr("Double Channels"), this);
     m_channelsAction->setCheckable(true);
     connect(m_channelsAction, SIGNAL(triggered(bool)), this, SLOT(writeSettings()));
 
-    createPalette(MIN_ROW);
+    m_overlayAction = new QAction(tr("Centroid Overlay"), this);
+    m_overlayAction->setCheckable(true);
+    connect(m_overlayAction, SIGNAL(triggered(bool)), this, SLOT(writeSettings()));
+
+#ifdef VOICE_OPENGL
+    m_openGLAction = new QAction(tr("OpenGL Rendering"), this);
+    m_openGLAction->setCheckable(true);
+    connect(m_openGLAction, SIGNAL(triggered(bool)), this, SLOT(writeSettings()));
+#endif
+
+    m_qualityAction = new QAction(this);
+    m_qualityAction->setEnabled(false);
+
+    m_analyzer = new VisualAnalyzer(this);
+    m_frameClock.start();
+
     createMenu();
     readSettings();
 }
 
 Voice::~Voice()
 {
-    delete[] m_visualData;
-    delete[] m_xscale;
+    // the analyzer takes its data from here until it is gone
+    delete m_analyzer;
+    delete[] m_history;
+    delete[] m_spare;
 }
 
 void Voice::start()
@@ -63,12 +91,14 @@ void Voice::start()
     if(isVisible())
     {
         m_timer->start();
+        m_analyzer->start();
     }
 }
 
 void Voice::stop()
 {
     m_timer->stop();
+    m_analyzer->stop();
 }
 
 void Voice::readSettings()
@@ -80,9 +110,25 @@ void Voice::readSettings()
 #endif
     settings.beginGroup("Voice");
     m_channelsAction->setChecked(settings.value("show_two_channels", true).toBool());
+    m_overlayAction->setChecked(settings.value("centroid_overlay", false).toBool());
+#ifdef VOICE_OPENGL
+    m_openGLAction->setChecked(settings.value("opengl", false).toBool());
+#endif
     m_palette = static_cast<VisualPalette::Palette>(settings.value("palette", VisualPalette::PALETTE_DEFAULT).toInt());
     m_rangeValue = settings.value("range", 30).toInt();
+    VisualAnalyzer::Settings analysis = m_analyzer->settings();
+    analysis.analysis = static_cast<VisualAnalyzer::Analysis>(settings.value("analysis", VisualAnalyzer::ANALYSIS_LINEAR).toInt());
+    analysis.window = static_cast<VisualSTFT::Window>(settings.value("window", VisualSTFT::WINDOW_DEFAULT).toInt());
+    analysis.hop = settings.value("hop", QMMP_VISUAL_NODE_SIZE).toInt();
+    analysis.latency = settings.value("latency", 0).toInt();
+    analysis.twoChannels = m_channelsAction->isChecked();
+    analysis.overlay = m_overlayAction->isChecked();
+    m_analyzer->setSettings(analysis);
+    m_governor.setBudget(settings.value("cpu_budget", 20).toInt());
     settings.endGroup();
+    applyQuality();
+    createColorTable();
+    createPresenter();
 
     for(QAction *act : m_typeActions->actions())
     {
@@ -101,6 +147,51 @@ void Voice::readSettings()
             break;
         }
     }
+
+    for(QAction *act : m_analysisActions->actions())
+    {
+        if(m_analyzer->settings().analysis == static_cast<VisualAnalyzer::Analysis>(act->data().toInt()))
+        {
+            act->setChecked(true);
+            break;
+        }
+    }
+
+    for(QAction *act : m_windowActions->actions())
+    {
+        if(m_analyzer->settings().window == static_cast<VisualSTFT::Window>(act->data().toInt()))
+        {
+            act->setChecked(true);
+            break;
+        }
+    }
+
+    for(QAction *act : m_hopActions->actions())
+    {
+        if(m_analyzer->settings().hop == act->data().toInt())
+        {
+            act->setChecked(true);
+            break;
+        }
+    }
+
+    for(QAction *act : m_latencyActions->actions())
+    {
+        if(m_analyzer->settings().latency == act->data().toInt())
+        {
+            act->setChecked(true);
+            break;
+        }
+    }
+
+    for(QAction *act : m_budgetActions->actions())
+    {
+        if(m_governor.budget() == act->data().toInt())
+        {
+            act->setChecked(true);
+            break;
+        }
+    }
 }
 
 void Voice::writeSettings()
@@ -112,74 +203,133 @@ void Voice::writeSettings()
 #endif
     settings.beginGroup("Voice");
     settings.setValue("show_two_channels", m_channelsAction->isChecked());
+    settings.setValue("centroid_overlay", m_overlayAction->isChecked());
+#ifdef VOICE_OPENGL
+    settings.setValue("opengl", m_openGLAction->isChecked());
+#endif
     QAction *act = m_typeActions->checkedAction();
     settings.setValue("palette", m_palette = (act ? static_cast<VisualPalette::Palette>(act->data().toInt()) : VisualPalette::PALETTE_DEFAULT));
     act = m_rangeActions->checkedAction();
     settings.setValue("range", m_rangeValue = (act ? act->data().toInt() : 30));
+    VisualAnalyzer::Settings analysis = m_analyzer->settings();
+    act = m_analysisActions->checkedAction();
+    analysis.analysis = act ? static_cast<VisualAnalyzer::Analysis>(act->data().toInt()) : VisualAnalyzer::ANALYSIS_LINEAR;
+    act = m_windowActions->checkedAction();
+    analysis.window = act ? static_cast<VisualSTFT::Window>(act->data().toInt()) : VisualSTFT::WINDOW_DEFAULT;
+    act = m_hopActions->checkedAction();
+    analysis.hop = act ? act->data().toInt() : QMMP_VISUAL_NODE_SIZE;
+    act = m_latencyActions->checkedAction();
+    analysis.latency = act ? act->data().toInt() : 0;
+    analysis.twoChannels = m_channelsAction->isChecked();
+    analysis.overlay = m_overlayAction->isChecked();
+    m_analyzer->setSettings(analysis);
+    settings.setValue("analysis", m_analyzer->settings().analysis);
+    settings.setValue("window", m_analyzer->settings().window);
+    settings.setValue("hop", m_analyzer->settings().hop);
+    settings.setValue("latency", m_analyzer->settings().latency);
+    act = m_budgetActions->checkedAction();
+    const int budget = act ? act->data().toInt() : 20;
+    if(m_governor.budget() != budget)
+    {
+        m_governor.setBudget(budget);
+        applyQuality();
+    }
+    settings.setValue("cpu_budget", m_governor.budget());
     settings.endGroup();
 
-    initialize();
+    // palette and range only change the colors of the history
+    createColorTable();
+    if(m_backgroundImage.height() != m_analyzer->height())
+    {
+        initialize();
+    }
+    createPresenter();
+    update();
 }
 
 void Voice::updateVisual()
 {
-    if(takeData(m_left, m_right))
+    QElapsedTimer cost;
+    cost.start();
+    if(m_backgroundImage.isNull() || !m_resizeTimer->isActive())
+    {
+        adjustRows();
+    }
+
+    m_analyzer->setSampleRate(SoundCore::instance()->frequency());
+
+    // the analyzer may have finished several columns since the last tick
+    const bool wrapped = m_wrapped;
+    const qint64 now = m_analyzer->clock();
+    int columns = 0;
+    while(drawColumn(now))
     {
-        process(m_left, m_right);
-        update();
+        ++columns;
     }
+    presentColumns(wrapped);
+
+    m_paintCost += cost.nsecsElapsed();
+    governQuality(columns > 0);
 }
 
 void Voice::hideEvent(QHideEvent *)
 {
     m_timer->stop();
+    m_analyzer->stop();
 }
 
 void Voice::showEvent(QShowEvent *)
 {
     m_timer->start();
+    m_analyzer->start();
 }
 
-void Voice::paintEvent(QPaintEvent *)
+void Voice::paintEvent(QPaintEvent *e)
 {
+    if(m_presenter)
+    {
+        return;
+    }
+
+    QElapsedTimer cost;
+    cost.start();
     QPainter painter(this);
-    painter.setRenderHints(QPainter::Antialiasing | QPainter::SmoothPixmapTransform);
-    painter.fillRect(rect(), Qt::black);
+    const QRect exposed = e->rect();
+    const int w = m_backgroundImage.width();
+    const int h = m_backgroundImage.height();
+    const QRect area(0, (height() - h) / 2, w, h);
+
+    if(m_backgroundImage.isNull() || !area.contains(exposed))
+    {
+        painter.fillRect(exposed, Qt::black);
+    }
 
     if(m_backgroundImage.isNull())
     {
         return;
     }
 
-    const bool showTwoChannels = m_channelsAction->isChecked();
-    const int level = 255 - m_rangeValue;
-
-    for(int i = 1; i < m_rows; ++i)
+    // once wrapped, the oldest columns start at the write column and the
+    // newest end before it
+    const int shift = m_wrapped ? m_offset : 0;
+    const QRect parts[] = {QRect(0, area.y(), w - shift, h), QRect(w - shift, area.y(), shift, h)};
+    for(const QRect &part : parts)
     {
-        const int w = m_backgroundImage.width();
-        if(m_offset >= w)
-        {
-            m_offset = w - 1;
-            m_backgroundImage = m_backgroundImage.copy(1, 0, w, m_backgroundImage.height());
-        }
-
-        if(!showTwoChannels)
+        const QRect target = part.intersected(exposed);
+        if(!target.isEmpty())
         {
-            const double left = qBound(0, m_visualData[i - 1] / 2, level) * 1.0 / level;
-            m_backgroundImage.setPixel(m_offset, m_rows - i, VisualPalette::renderPalette(m_palette, left));
-        }
-        else
-        {
-            const double left = qBound(0, m_visualData[i - 1] / 2, level) * 1.0 / level;
-            m_backgroundImage.setPixel(m_offset, m_rows - i, VisualPalette::renderPalette(m_palette, left));
-
-            const double right = qBound(0, m_visualData[m_rows + i - 1] / 2, level) * 1.0 / level;
-            m_backgroundImage.setPixel(m_offset, 2 * m_rows - i, VisualPalette::renderPalette(m_palette, right));
+            painter.drawImage(target.x(), target.y(), m_backgroundImage, (target.x() + shift) % w, target.y() - area.y(), target.width(), target.height());
         }
     }
+    painter.end();
+    m_paintCost += cost.nsecsElapsed();
+}
 
-    ++m_offset;
-    painter.drawImage(0, (height() - (showTwoChannels ? 2 : 1) * m_rows) / 2, m_backgroundImage);
+void Voice::resizeEvent(QResizeEvent *)
+{
+    // while resizing the old geometry is drawn from the left edge,
+    // centred vertically and clipped
+    m_resizeTimer->start();
 }
 
 void Voice::contextMenuEvent(QContextMenuEvent *)
@@ -187,65 +337,147 @@ void Voice::contextMenuEvent(QContextMenuEvent *)
     m_menu->exec(QCursor::pos());
 }
 
-void Voice::process(float *left, float *right)
+void Voice::adjustRows()
 {
-    const int rows = height();
-    const int cols = width();
+    const int most = VisualGovernor::quality(m_governor.tier()).rows;
+    const int rows = height() < 2 * most ? height() / 2 : most;
+    VisualAnalyzer::Settings settings = m_analyzer->settings();
 
-    if(rows < 2 * MIN_ROW && m_rows != rows / 2)
+    if(settings.rows != rows)
     {
-        createPalette(rows / 2);
+        settings.rows = rows;
+        m_analyzer->setSettings(settings);
         initialize();
     }
-    else if(rows >= 2 * MIN_ROW && m_rows != MIN_ROW)
+    else if(m_backgroundImage.width() != width())
     {
-        createPalette(MIN_ROW);
         initialize();
     }
-    else if(m_backgroundImage.width() != cols)
+}
+
+void Voice::applyQuality()
+{
+    // the rows follow on the next tick
+    const VisualGovernor::Quality &quality = VisualGovernor::quality(m_governor.tier());
+    m_timer->setInterval(quality.interval);
+
+    VisualAnalyzer::Settings settings = m_analyzer->settings();
+    if(settings.size != quality.size)
     {
-        initialize();
+        settings.size = quality.size;
+        m_analyzer->setSettings(settings);
     }
 
-    short destl[256], destr[256];
-    calc_freq(destl, left);
-    calc_freq(destr, right);
+    QString name;
+    switch(m_governor.tier())
+    {
+    case VisualGovernor::TIER_HIGH: name = tr("High"); break;
+    case VisualGovernor::TIER_LOW: name = tr("Low"); break;
+    case VisualGovernor::TIER_LOWEST: name = tr("Lowest"); break;
+    default: name = tr("Normal"); break;
+    }
+    m_qualityAction->setText(tr("Quality: %1").arg(name));
+}
 
-    const double yscale = (double)1.25 * m_cols / std::log(256);
+void Voice::governQuality(bool drawn)
+{
+    const qint64 cost = m_analyzer->takeCost() + m_paintCost;
+    const qint64 elapsed = m_frameClock.nsecsElapsed();
+    m_frameClock.restart();
+    m_paintCost = 0;
+
+    // ticks without columns, while paused or waiting for audio, tell
+    // nothing of what drawing costs
+    if(drawn && m_governor.update(cost, elapsed))
+    {
+        applyQuality();
+    }
+}
 
-    for(int i = 0; i < m_rows; ++i)
+bool Voice::drawColumn(qint64 now)
+{
+    if(m_backgroundImage.isNull())
     {
-        short yl = 0, yr = 0;
-        int magnitudel = 0, magnituder = 0;
+        return false;
+    }
 
-        if(m_xscale[i] == m_xscale[i + 1])
-        {
-            yl = (i >= 256 ? 0 : (destl[i] >> 7)); //128
-            yr = (i >= 256 ? 0 : (destr[i] >> 7)); //128
-        }
+    const int w = m_backgroundImage.width();
+    const int h = m_backgroundImage.height();
+    if(m_offset >= w)
+    {
+        m_offset = 0;
+        m_wrapped = true;
+    }
 
-        for(int k = m_xscale[i]; k < m_xscale[i + 1]; ++k)
-        {
-            yl = (k >= 256 ? 0 : qMax(short(destl[k] >> 7), yl));
-            yr = (k >= 256 ? 0 : qMax(short(destr[k] >> 7), yr));
-        }
+    if(!m_analyzer->takeColumn(m_history + m_offset * h, now))
+    {
+        return false;
+    }
 
-        if(yl > 0)
-        {
-            magnitudel = qBound(0, int(std::log(yl) * yscale), m_cols);
-        }
+    ++m_offset;
+    m_pending = qMin(m_pending + 1, w);
+    return true;
+}
 
-        if(yr > 0)
-        {
-            magnituder = qBound(0, int(std::log(yr) * yscale), m_cols);
-        }
+void Voice::transposeColumns()
+{
+    if(m_pending == 0)
+    {
+        return;
+    }
+
+    const int w = m_backgroundImage.width();
+    const int h = m_backgroundImage.height();
+    uchar *bits = m_backgroundImage.bits();
+    const int stride = m_backgroundImage.bytesPerLine();
+
+    // the pending columns end before the write column and may wrap around
+    int first = m_offset - m_pending;
+    if(first < 0)
+    {
+        spectrum_transpose(m_history + (first + w) * h, h, bits + first + w, stride, h, -first);
+        first = 0;
+    }
+    spectrum_transpose(m_history + first * h, h, bits + first, stride, h, m_offset - first);
+    m_pending = 0;
+}
+
+void Voice::presentColumns(bool wrapped)
+{
+    const int columns = m_pending;
+    if(columns == 0)
+    {
+        return;
+    }
 
-        m_visualData[i] -= m_analyzerSize * m_cols / 15;
-        m_visualData[i] = magnitudel > m_visualData[i] ? magnitudel : m_visualData[i];
+#ifdef VOICE_OPENGL
+    if(m_presenter)
+    {
+        // the image falls behind until the presenter goes away
+        m_presenter->updateColumns(m_offset - columns, columns, m_wrapped ? m_offset : 0);
+        m_pending = 0;
+        return;
+    }
+#endif
 
-        const int j = m_rows + i;
-        m_visualData[j] -= m_analyzerSize * m_cols / 15;
-        m_visualData[j] = magnituder > m_visualData[j] ? magnituder : m_visualData[j];
+    transposeColumns();
+
+    const int w = m_backgroundImage.width();
+    const int h = m_backgroundImage.height();
+    const QRect area(0, (height() - h) / 2, w, h);
+    if(!m_wrapped)
+    {
+        // the new columns were written next to the old ones
+        update(m_offset - columns, area.y(), columns, h);
+    }
+    else if(wrapped && columns < w)
+    {
+        // the old columns move over and only the new ones are exposed
+        scroll(-columns, 0, area);
+    }
+    else
+    {
+        update(area);
     }
 }
 
@@ -255,6 +487,11 @@ void Voice::createMenu()
     connect(m_menu, SIGNAL(triggered(QAction*)), SLOT(writeSettings()));
 
     m_menu->addAction(m_channelsAction);
+    m_menu->addAction(m_overlayAction);
+#ifdef VOICE_OPENGL
+    m_menu->addAction(m_openGLAction);
+#endif
+    m_menu->addAction(m_qualityAction);
 
     m_typeActions = new QActionGroup(this);
     m_typeActions->setExclusive(true);
@@ -277,19 +514,11 @@ void Voice::createMenu()
 
     m_rangeActions = new QActionGroup(this);
     m_rangeActions->setExclusive(true);
-    m_rangeActions->addAction(tr("0 DB"))->setData(0);
-    m_rangeActions->addAction(tr("10 DB"))->setData(10);
-    m_rangeActions->addAction(tr("20 DB"))->setData(20);
-    m_rangeActions->addAction(tr("30 DB"))->setData(30);
-    m_rangeActions->addAction(tr("40 DB"))->setData(40);
-    m_rangeActions->addAction(tr("50 DB"))->setData(50);
-    m_rangeActions->addAction(tr("60 DB"))->setData(60);
-    m_rangeActions->addAction(tr("70 DB"))->setData(70);
-    m_rangeActions->addAction(tr("80 DB"))->setData(80);
-    m_rangeActions->addAction(tr("90 DB"))->setData(90);
-    m_rangeActions->addAction(tr("100 DB"))->setData(100);
-    m_rangeActions->addAction(tr("110 DB"))->setData(110);
-    m_rangeActions->addAction(tr("120 DB"))->setData(120);
+    // each step of the range takes one level step off the top of the palette
+    for(int steps = 0; steps <= 120; steps += 10)
+    {
+        m_rangeActions->addAction(tr("%1 dB").arg(VisualAnalyzer::rangeDecibels(steps), 0, 'f', 1))->setData(steps);
+    }
 
     QMenu *rangeMenu = m_menu->addMenu(tr("Range"));
     for(QAction *act : m_rangeActions->actions())
@@ -298,31 +527,247 @@ void Voice::createMenu()
         rangeMenu->addAction(act);
     }
 
+    m_analysisActions = new QActionGroup(this);
+    m_analysisActions->setExclusive(true);
+    m_analysisActions->addAction(tr("Linear"))->setData(VisualAnalyzer::ANALYSIS_LINEAR);
+    m_analysisActions->addAction(tr("Constant Q"))->setData(VisualAnalyzer::ANALYSIS_CONSTANT_Q);
+    m_analysisActions->addAction(tr("Multi Resolution"))->setData(VisualAnalyzer::ANALYSIS_MULTI_RESOLUTION);
+    m_analysisActions->addAction(tr("Reassigned"))->setData(VisualAnalyzer::ANALYSIS_REASSIGNED);
+
+    QMenu *analysisMenu = m_menu->addMenu(tr("Analysis"));
+    for(QAction *act : m_analysisActions->actions())
+    {
+        act->setCheckable(true);
+        analysisMenu->addAction(act);
+    }
+
+    m_windowActions = new QActionGroup(this);
+    m_windowActions->setExclusive(true);
+    m_windowActions->addAction(tr("Rectangular"))->setData(VisualSTFT::WINDOW_RECTANGULAR);
+    m_windowActions->addAction(tr("Hann"))->setData(VisualSTFT::WINDOW_HANN);
+    m_windowActions->addAction(tr("Blackman-Harris"))->setData(VisualSTFT::WINDOW_BLACKMAN_HARRIS);
+    m_windowActions->addAction(tr("Kaiser"))->setData(VisualSTFT::WINDOW_KAISER);
+
+    QMenu *windowMenu = m_menu->addMenu(tr("Window"));
+    for(QAction *act : m_windowActions->actions())
+    {
+        act->setCheckable(true);
+        windowMenu->addAction(act);
+    }
+
+    m_hopActions = new QActionGroup(this);
+    m_hopActions->setExclusive(true);
+    m_hopActions->addAction(tr("512 Samples"))->setData(512);
+    m_hopActions->addAction(tr("256 Samples"))->setData(256);
+    m_hopActions->addAction(tr("128 Samples"))->setData(128);
+    m_hopActions->addAction(tr("64 Samples"))->setData(64);
+
+    QMenu *hopMenu = m_menu->addMenu(tr("Hop Size"));
+    for(QAction *act : m_hopActions->actions())
+    {
+        act->setCheckable(true);
+        hopMenu->addAction(act);
+    }
+
+    m_latencyActions = new QActionGroup(this);
+    m_latencyActions->setExclusive(true);
+    m_latencyActions->addAction(tr("0 MS"))->setData(0);
+    m_latencyActions->addAction(tr("50 MS"))->setData(50);
+    m_latencyActions->addAction(tr("100 MS"))->setData(100);
+    m_latencyActions->addAction(tr("200 MS"))->setData(200);
+    m_latencyActions->addAction(tr("300 MS"))->setData(300);
+    m_latencyActions->addAction(tr("500 MS"))->setData(500);
+
+    QMenu *latencyMenu = m_menu->addMenu(tr("Latency"));
+    for(QAction *act : m_latencyActions->actions())
+    {
+        act->setCheckable(true);
+        latencyMenu->addAction(act);
+    }
+
+    m_budgetActions = new QActionGroup(this);
+    m_budgetActions->setExclusive(true);
+    m_budgetActions->addAction(tr("Off"))->setData(0);
+    m_budgetActions->addAction(tr("10%"))->setData(10);
+    m_budgetActions->addAction(tr("20%"))->setData(20);
+    m_budgetActions->addAction(tr("40%"))->setData(40);
+    m_budgetActions->addAction(tr("80%"))->setData(80);
+
+    QMenu *budgetMenu = m_menu->addMenu(tr("CPU Budget"));
+    for(QAction *act : m_budgetActions->actions())
+    {
+        act->setCheckable(true);
+        budgetMenu->addAction(act);
+    }
+
     adjustMenuPosition(m_menu);
     adjustMenuPosition(typeMenu);
     adjustMenuPosition(rangeMenu);
+    adjustMenuPosition(analysisMenu);
+    adjustMenuPosition(windowMenu);
+    adjustMenuPosition(hopMenu);
+    adjustMenuPosition(latencyMenu);
+    adjustMenuPosition(budgetMenu);
 }
 
-void Voice::createPalette(int row)
+void Voice::createColorTable()
 {
-    m_rows = row;
-    m_cols = MIN_COLUMN;
+    // step i of the history at the level it has over the current range
+    const int steps = VisualAnalyzer::LEVEL_STEPS;
+    float levels[steps];
+    for(int i = 0; i < steps; ++i)
+    {
+        levels[i] = float(i) / steps;
+    }
+
+    m_colorTable.resize(256);
+    VisualPalette::renderColumn(m_palette, levels, reinterpret_cast<uint32_t*>(m_colorTable.data()), steps,
+                                float(steps) / (steps - m_rangeValue));
+    m_colorTable[VisualAnalyzer::OVERLAY_INDEX] = qRgb(255, 255, 255);
 
-    delete[] m_visualData;
-    delete[] m_xscale;
+    if(!m_backgroundImage.isNull())
+    {
+        m_backgroundImage.setColorTable(m_colorTable);
+    }
+
+#ifdef VOICE_OPENGL
+    if(m_presenter)
+    {
+        m_presenter->setColorTable(m_colorTable);
+    }
+#endif
+}
+
+void Voice::createPresenter()
+{
+#ifdef VOICE_OPENGL
+    if(m_openGLAction->isChecked() && !m_presenter)
+    {
+        if(!layout())
+        {
+            QHBoxLayout *box = new QHBoxLayout(this);
+            box->setContentsMargins(0, 0, 0, 0);
+        }
 
-    m_visualData = new int[m_rows * 2]{0};
-    m_xscale = new int[m_rows + 1]{0};
+        m_presenter = new VisualGLPresenter(this);
+        connect(m_presenter, SIGNAL(failed()), SLOT(presenterFailed()));
+        layout()->addWidget(m_presenter);
+        m_presenter->setColorTable(m_colorTable);
+        if(!m_backgroundImage.isNull())
+        {
+            m_presenter->setHistory(m_history, m_backgroundImage.width(), m_backgroundImage.height());
+            m_presenter->updateColumns(m_offset, 0, m_wrapped ? m_offset : 0);
+        }
+    }
+    else if(!m_openGLAction->isChecked() && m_presenter)
+    {
+        destroyPresenter();
+    }
+#endif
+}
 
-    for(int i = 0; i < m_rows + 1; ++i)
+void Voice::destroyPresenter()
+{
+#ifdef VOICE_OPENGL
+    if(!m_presenter)
     {
-        m_xscale[i] = std::pow(255.0, float(i) / m_rows);
+        return;
     }
+
+    m_presenter->deleteLater();
+    m_presenter = nullptr;
+
+    // bring the image up to date with every column
+    m_pending = m_backgroundImage.width();
+    transposeColumns();
+    update();
+#endif
+}
+
+void Voice::presenterFailed()
+{
+#ifdef VOICE_OPENGL
+    // the painter takes over for the rest of the session
+    m_openGLAction->setChecked(false);
+    m_openGLAction->setEnabled(false);
+    destroyPresenter();
+#endif
 }
 
 void Voice::initialize()
 {
-    m_offset = 0;
-    m_backgroundImage = QImage(width(), (m_channelsAction->isChecked() ? 2 : 1) * m_rows, QImage::Format_RGB32);
-    m_backgroundImage.fill(Qt::black);
+    const int w = width();
+    const int h = m_analyzer->height();
+    const int channels = m_analyzer->settings().twoChannels ? 2 : 1;
+
+    if(w * h > m_historyCapacity || !m_history)
+    {
+        // both buffers are outgrown, the spare is made once the old
+        // history is resampled
+        m_historyCapacity = qMax(w * h, 2 * m_historyCapacity);
+        uchar *history = new uchar[m_historyCapacity];
+        resampleHistory(history, w, h / channels, channels);
+        delete[] m_history;
+        delete[] m_spare;
+        m_history = history;
+        m_spare = new uchar[m_historyCapacity];
+    }
+    else
+    {
+        resampleHistory(m_spare, w, h / channels, channels);
+        std::swap(m_history, m_spare);
+    }
+
+    m_backgroundImage = QImage(w, h, QImage::Format_Indexed8);
+    m_backgroundImage.setColorTable(m_colorTable);
+    m_backgroundImage.fill(0);
+    m_pending = m_offset;
+    transposeColumns();
+    update();
+
+#ifdef VOICE_OPENGL
+    if(m_presenter)
+    {
+        m_presenter->setHistory(m_history, m_backgroundImage.width(), m_backgroundImage.height());
+    }
+#endif
+}
+
+void Voice::resampleHistory(uchar *history, int width, int rows, int channels)
+{
+    // the newest columns that fit go to history a hop apart, each line
+    // is taken from the nearest row of the old layout, whose rows span
+    // the same octaves whatever their number
+    const int oldWidth = m_backgroundImage.width();
+    const int oldHeight = m_backgroundImage.height();
+    const int oldRows = oldHeight / m_channels;
+    const int count = m_wrapped ? oldWidth : qMin(m_offset, oldWidth);
+    const int kept = oldRows > 1 ? qMin(count, width) : 0;
+    const int h = rows * channels;
+
+    QVector<int> lines(h);
+    for(int i = 0; i < h; ++i)
+    {
+        // the top line of each channel stays empty
+        const int channel = i / rows;
+        const int line = i % rows;
+        const int row = line > 0 ? qMin((2 * (rows - 1 - line) + 1) * oldRows / (2 * rows), oldRows - 2) : oldRows - 1;
+        lines[i] = qMin(channel, m_channels - 1) * oldRows + oldRows - 1 - row;
+    }
+
+    for(int i = 0; i < kept; ++i)
+    {
+        const int column = count - kept + i;
+        const uchar *source = m_history + ((m_wrapped ? m_offset + column : column) % oldWidth) * oldHeight;
+        uchar *target = history + i * h;
+        for(int j = 0; j < h; ++j)
+        {
+            target[j] = source[lines[j]];
+        }
+    }
+    memset(history + kept * h, 0, (width - kept) * h);
+
+    m_offset = kept;
+    m_wrapped = false;
+    m_channels = channels;
 }
@@ -21,9 +21,12 @@
 
 #include <qmmp/visual.h>
 #include "visualpalette.h"
+#include "visualanalyzer.h"
+#include "visualgovernor.h"
 
 class QMenu;
 class QActionGroup;
+class VisualGLPresenter;
 
 /*!
  * @author Greedysky <greedysky@163.com>
@@ -35,6 +38,12 @@ public:
     explicit Voice(QWidget *parent = nullptr);
     virtual ~Voice();
 
+    /*!
+     * Returns the spectral features of the frames analysed so far, taken
+     * from the linear analysis of the left channel.
+     */
+    inline const VisualFeatures *features() const { return m_analyzer->features(); }
+
 public slots:
     virtual void start() override final;
     virtual void stop() override final;
@@ -43,33 +52,62 @@ private slots:
     void readSettings();
     void writeSettings();
     void updateVisual();
+    void adjustRows();
+    void presenterFailed();
 
 private:
+    // takes the nodes of the visual buffer
+    friend class VisualAnalyzer;
+
     virtual void hideEvent(QHideEvent *e) override final;
     virtual void showEvent(QShowEvent *e) override final;
-    virtual void paintEvent(QPaintEvent *) override final;
+    virtual void paintEvent(QPaintEvent *e) override final;
+    virtual void resizeEvent(QResizeEvent *e) override final;
     virtual void contextMenuEvent(QContextMenuEvent *e) override final;
 
-    void process(float *left, float *right);
+    void applyQuality();
+    void governQuality(bool drawn);
+    bool drawColumn(qint64 now);
+    void transposeColumns();
+    void presentColumns(bool wrapped);
     void createMenu();
-    void createPalette(int row);
+    void createColorTable();
+    void createPresenter();
+    void destroyPresenter();
     void initialize();
+    void resampleHistory(uchar *history, int width, int rows, int channels);
 
     VisualPalette::Palette m_palette= VisualPalette::PALETTE_DEFAULT;
+    // the columns of the analyzer, colored by m_colorTable
     QImage m_backgroundImage;
+    QVector<QRgb> m_colorTable;
+    // the history is a ring, columns are written at m_offset and wrap around
+    // once the image is full
     int m_offset = 0;
-    int *m_xscale = nullptr;
-    const double m_analyzerSize = 2.2;
+    bool m_wrapped = false;
+    // the same levels stored column by column, the last m_pending columns
+    // are yet to be transposed into the image; m_history holds m_channels
+    // channels, and it and m_spare, which it is resampled into on a new
+    // geometry, only ever grow to m_historyCapacity bytes
+    uchar *m_history = nullptr, *m_spare = nullptr;
+    int m_channels = 1, m_historyCapacity = 0;
+    int m_pending = 0;
     QTimer *m_timer = nullptr;
-    int m_rows = 0, m_cols = 0;
-    int *m_visualData = nullptr;
-    float m_left[QMMP_VISUAL_NODE_SIZE];
-    float m_right[QMMP_VISUAL_NODE_SIZE];
+    // the geometry follows the widget once it stopped resizing
+    QTimer *m_resizeTimer = nullptr;
     int m_rangeValue = 30;
+    VisualAnalyzer *m_analyzer = nullptr;
+    // presents the history instead of paintEvent while OpenGL is used
+    VisualGLPresenter *m_presenter = nullptr;
+    // steps the quality by the cost of the frames, paint time is gathered
+    // here since the last frame and the analysis time by the analyzer
+    VisualGovernor m_governor;
+    QElapsedTimer m_frameClock;
+    qint64 m_paintCost = 0;
 
     QMenu *m_menu;
-    QAction *m_channelsAction;
-    QActionGroup *m_typeActions, *m_rangeActions;
+    QAction *m_channelsAction, *m_overlayAction, *m_openGLAction = nullptr, *m_qualityAction;
+    QActionGroup *m_typeActions, *m_rangeActions, *m_analysisActions, *m_windowActions, *m_hopActions, *m_latencyActions, *m_budgetActions;
 
 };
 
@@ -10,11 +10,37 @@ include($$PWD/common/common.pri)
 
 HEADERS += voice.h \
            visualvoicefactory.h \
-           visualpalette.h
+           visualpalette.h \
+           visualstft.h \
+           visualwisdom.h \
+           visualconstantq.h \
+           visualreassignment.h \
+           visualfeatures.h \
+           visualanalyzer.h \
+           visualgovernor.h \
+           visualglpresenter.h
 
 SOURCES += voice.cpp \
            visualvoicefactory.cpp \
-           visualpalette.cpp
+           visualpalette.cpp \
+           visualstft.cpp \
+           visualwisdom.cpp \
+           visualconstantq.cpp \
+           visualreassignment.cpp \
+           visualfeatures.cpp \
+           visualanalyzer.cpp \
+           visualgovernor.cpp \
+           visualglpresenter.cpp
+
+# QOpenGLWidget came with Qt 5.4 and moved into its own module in Qt 6
+greaterThan(QT_MAJOR_VERSION, 4){
+    contains(QT_CONFIG, opengl)|contains(QT_CONFIG, opengles2){
+        DEFINES += VOICE_OPENGL
+        greaterThan(QT_MAJOR_VERSION, 5){
+            QT += opengl openglwidgets
+        }
+    }
+}
 
 #CONFIG += BUILD_PLUGIN_INSIDE
 contains(CONFIG, BUILD_PLUGIN_INSIDE){